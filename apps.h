@@ -0,0 +1,632 @@
+#pragma once
+
+#include <assert.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <numeric>
+#include <algorithm>
+#include <filesystem>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "system-index.h"
+
+namespace fs = std::filesystem;
+
+#define eprintf(...) fprintf(stderr, __VA_ARGS__)
+#define shift(argc, argv) (assert(argc), argc--, *argv++)
+
+struct file_t {
+  const std::string_view sv;
+  size_t size;
+
+  inline constexpr
+  file_t(void) noexcept
+    : sv(""), size(0) {}
+
+  inline constexpr
+  file_t(const std::string_view sv, off_t size) noexcept
+    : sv(sv), size(size) {}
+
+  inline constexpr char
+  operator[](off_t offset) const noexcept
+  {
+    return sv[offset];
+  };
+
+  inline constexpr ~file_t(void)
+  {
+    char *ptr = const_cast<char *>(sv.data());
+
+    if (ptr == 0 or size == 0) return;
+
+    if (munmap(ptr, size) == -1) [[unlikely]] {
+      eprintf("could not unmap file\n");
+      exit(EXIT_FAILURE);
+    }
+
+#if not defined(NDEBUG)
+    printf("unmapped %zu bytes from %p\n", size, ptr);
+#endif
+  }
+
+  static const file_t read(const char *file_path, bool *ok, int dirfd = AT_FDCWD);
+};
+
+// name and exec point into app_strings or into the mapped system index,
+// both keep them nul terminated
+struct app_t {
+  std::string_view name, exec;
+
+  // reads Name (lowercased), its initials and Exec into reusable buffers,
+  // false when the file could not be read
+  static bool parse(const char *file_path,
+                    std::string &name,
+                    std::string &exec,
+                    std::string &initials,
+                    int dirfd = AT_FDCWD);
+};
+
+// append-only storage for the strings of parsed apps. blocks never move, so
+// views into them stay valid while more strings are added.
+struct strings_t {
+  static constexpr size_t BLOCK_SIZE = 64 * 1024;
+
+  std::vector<std::unique_ptr<char[]>> blocks;
+  size_t used = BLOCK_SIZE;
+
+  std::string_view intern(const std::string_view &s)
+  {
+    const auto n = s.size() + 1;
+    if (used + n > BLOCK_SIZE) {
+      blocks.emplace_back(new char[std::max(n, BLOCK_SIZE)]);
+      used = 0;
+    }
+
+    char *ret = blocks.back().get() + used;
+    memcpy(ret, s.data(), s.size());
+    ret[s.size()] = '\0';
+    used += n;
+
+    return std::string_view(ret, s.size());
+  }
+
+  void clear(void)
+  {
+    blocks.clear();
+    used = BLOCK_SIZE;
+  }
+};
+
+const file_t file_t::read(const char *file_path, bool *ok, int dirfd)
+{
+  int fd = openat(dirfd, file_path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    *ok = false;
+    return {};
+  }
+
+  struct stat file_info = {0};
+  if (fstat(fd, &file_info) == -1) {
+    close(fd);
+    *ok = false;
+    return {};
+  }
+
+  const off_t size = file_info.st_size;
+  if (size == 0) {
+    close(fd);
+    return {};
+  }
+
+  char *ptr = (char *) mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  if (ptr == MAP_FAILED) {
+    close(fd);
+    *ok = false;
+    return {};
+  }
+
+  close(fd);
+
+  return file_t{ptr, size};
+}
+
+static inline std::vector<std::string_view>
+split(const std::string_view &sv, char delim)
+{
+  std::vector<std::string_view> ret;
+  size_t start = 0, pos = sv.find(delim);
+  while (pos != std::string::npos) {
+    ret.emplace_back(sv.data() + start, pos - start);
+    start = pos + 1;
+    pos = sv.find(delim, start);
+  }
+
+  if (start < sv.size()) {
+    ret.emplace_back(sv.data() + start, sv.size() - start);
+  }
+
+  return ret;
+}
+
+// the lowercased first character of every word of name: words start after
+// anything that is not a letter or digit, where digits meet letters, and at
+// the humps of camelCase, which only the name as written still has
+static inline void initials_of(const std::string_view &name, std::string &out)
+{
+  out.clear();
+
+  // multibyte characters count as letters and are taken whole
+  const auto alnum = [](uint8_t c) { return c >= 0x80 || isalnum(c); };
+
+  uint8_t prev = ' ';
+  bool taking = false;
+  for (const uint8_t c: name) {
+    if (taking && (c & 0xC0) == 0x80) {
+      out += c;
+    } else if (alnum(c) && (!alnum(prev)
+                            || (isupper(c) && islower(prev))
+                            || (c < 0x80 && prev < 0x80 && !isdigit(c) != !isdigit(prev))))
+    {
+      out += tolower(c);
+      taking = c >= 0xC0;
+    } else {
+      taking = false;
+    }
+    prev = c;
+  }
+}
+
+bool app_t::parse(const char *file_path, std::string &name, std::string &exec, std::string &initials, int dirfd)
+{
+  name.clear();
+  exec.clear();
+  initials.clear();
+
+  auto ok = true;
+  const auto file = file_t::read(file_path, &ok, dirfd);
+
+  if (file.size == 0) {
+    if (!ok) {
+      eprintf("could not read file: %s\n", file_path);
+    }
+    return ok;
+  }
+
+  for (const auto &line: split(file.sv, '\n')) {
+    if (!name.empty() && !exec.empty()) break;
+
+    if (line.find("Name=") == 0) {
+      name = line.substr(5);
+    } else if (line.find("Exec=") == 0) {
+      exec = line.substr(5);
+    }
+  }
+
+  initials_of(name, initials);
+  for (auto &c: name) c = tolower(c);
+
+  return true;
+}
+
+static std::vector<app_t> apps;
+static strings_t app_strings;
+
+// the initials parse() took from the names as written, one per app. empty
+// for apps that did not come from .desktop files, the search index then
+// takes them from the lowercased names.
+static std::vector<std::string_view> app_initials;
+static strings_t initials_strings;
+
+// how many entries of apps parse_apps() has finished, the ui reads those
+// while the rest is still being parsed on the loader thread
+static std::atomic<size_t> apps_ready;
+
+static std::unordered_map<std::string_view, size_t> ranks;
+static std::vector<size_t> app_ranks;
+
+static inline void rank_apps(void)
+{
+  app_ranks.resize(apps.size());
+  for (size_t i = 0; i < apps.size(); ++i) {
+    const auto it = ranks.find(apps[i].name);
+    app_ranks[i] = it == ranks.end() ? 0 : it->second;
+  }
+}
+
+// without a history file (a fresh install) every app ranks 0, app_ranks is
+// sized either way
+static inline void parse_ranks(const std::string_view &path)
+{
+  auto ok = true;
+  static const auto file = file_t::read(path.data(), &ok);
+
+  if (ok) {
+    for (auto line: split(file.sv, '\n')) {
+      ranks[line]++;
+    }
+  }
+
+  rank_apps();
+}
+
+static inline void write_rank(const std::string_view &path, const std::string_view &rank)
+{
+  std::ofstream file(std::string(path), std::ios::app);
+  if (!file.is_open()) return;
+
+  file << rank << '\n';
+  file.close();
+}
+
+// every app ordered by launch count, then by discovery order: the list an
+// empty prompt shows
+static std::vector<size_t> ranked_apps;
+
+static inline bool ranked_before(size_t a, size_t b)
+{
+  return app_ranks[a] != app_ranks[b] ? app_ranks[a] > app_ranks[b] : a < b;
+}
+
+static inline void rank_order(void)
+{
+  ranked_apps.resize(apps.size());
+  std::iota(ranked_apps.begin(), ranked_apps.end(), 0);
+
+  // only the launched apps move, the rest keeps discovery order
+  const auto launched = std::stable_partition(ranked_apps.begin(), ranked_apps.end(), [](const auto i) {
+    return app_ranks[i] > 0;
+  });
+  std::sort(ranked_apps.begin(), launched, ranked_before);
+}
+
+// counts a launch of name and moves its app up to where it now belongs
+static inline void promote_app(const std::string_view &name)
+{
+  const auto count = ++ranks[name];
+
+  auto it = std::find_if(ranked_apps.begin(), ranked_apps.end(), [&](const auto i) {
+    return apps[i].name == name;
+  });
+  if (it == ranked_apps.end()) return;
+
+  app_ranks[*it] = count;
+  for (; it != ranked_apps.begin() && ranked_before(*it, *(it - 1)); --it) {
+    std::iter_swap(it, it - 1);
+  }
+}
+
+// the head of ranked_apps, cached so the first frame can show it before
+// the index is loaded. one "name\texec" line per app.
+constexpr size_t RECENTS_CAP = 32;
+
+static std::vector<app_t> recents;
+static strings_t recent_strings;
+
+static inline void parse_recents(const std::string_view &path)
+{
+  auto ok = true;
+  const auto file = file_t::read(path.data(), &ok);
+  if (!ok) return;
+
+  for (const auto &line: split(file.sv, '\n')) {
+    const auto tab = line.find('\t');
+    if (tab == std::string::npos || recents.size() == RECENTS_CAP) continue;
+
+    recents.push_back(app_t{
+      recent_strings.intern(line.substr(0, tab)),
+      recent_strings.intern(line.substr(tab + 1)),
+    });
+  }
+}
+
+static inline void write_recents(const std::string_view &path)
+{
+  std::ofstream file(std::string(path), std::ios::trunc);
+  if (!file.is_open()) return;
+
+  for (size_t i = 0; i < std::min(ranked_apps.size(), RECENTS_CAP); ++i) {
+    const auto &app = apps[ranked_apps[i]];
+    if (app_ranks[ranked_apps[i]] == 0) break;
+    file << app.name << '\t' << app.exec << '\n';
+  }
+
+  file.close();
+}
+
+// a .desktop file found by discovery_t. its desktop file id is the path
+// below the applications dir with '/' turned into '-', so the file name is
+// the tail of the id. both live in discovery_t::arena, nul terminated.
+struct desktop_entry_t {
+  uint32_t dir;     // index into discovery_t::dirs
+  uint32_t id;      // offset of the id into the arena
+  uint32_t id_len;
+  uint32_t name;    // offset of the file name, openat()ed from dir
+};
+
+// walks applications dirs with directory fds and raw getdents64 buffers on
+// the stack, the only allocations are the arena and the two vectors.
+struct discovery_t {
+  static constexpr int MAX_DEPTH = 8;
+  static constexpr size_t DENTS_BUF_SIZE = 16 * 1024;
+
+  std::vector<int> dirs;
+  std::vector<desktop_entry_t> entries;
+  std::string arena, prefix;
+
+  // when set, the path of every dir walked below the ones discover()
+  // opened is appended to it, path being the one walk() is in
+  std::vector<std::string> *walked = NULL;
+  std::string path;
+
+  ~discovery_t(void)
+  {
+    for (const auto fd: dirs) close(fd);
+  }
+
+  inline std::string_view id(const desktop_entry_t &e) const noexcept
+  {
+    return std::string_view(arena.data() + e.id, e.id_len);
+  }
+
+  inline const char *name(const desktop_entry_t &e) const noexcept
+  {
+    return arena.data() + e.name;
+  }
+
+  // takes ownership of fd
+  void walk(int fd, int depth = 0)
+  {
+    dirs.emplace_back(fd);
+    const uint32_t dir = dirs.size() - 1;
+
+    alignas(struct dirent64) char buf[DENTS_BUF_SIZE];
+
+    ssize_t n;
+    while ((n = getdents64(fd, buf, sizeof(buf))) > 0) {
+      for (ssize_t off = 0; off < n;) {
+        const auto *d = (const struct dirent64 *) (buf + off);
+        off += d->d_reclen;
+
+        const char *name = d->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+
+        auto type = d->d_type;
+        if (type == DT_UNKNOWN || type == DT_LNK) {
+          struct stat st;
+          if (fstatat(fd, name, &st, 0) == -1) continue;
+          type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+
+        if (type == DT_DIR) {
+          if (depth == MAX_DEPTH) continue;
+
+          const int sub = openat(fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+          if (sub == -1) continue;
+
+          const auto prefix_len = prefix.size();
+          const auto path_len = path.size();
+          prefix += name;
+          prefix += '-';
+          if (walked) {
+            path += '/';
+            path += name;
+            walked->push_back(path);
+          }
+          walk(sub, depth + 1);
+          prefix.resize(prefix_len);
+          path.resize(path_len);
+        } else if (type == DT_REG && std::string_view(name).ends_with(".desktop")) {
+          const uint32_t id = arena.size();
+          arena += prefix;
+          arena += name;
+          entries.push_back({
+            .dir = dir,
+            .id = id,
+            .id_len = (uint32_t) (arena.size() - id),
+            .name = (uint32_t) (id + prefix.size()),
+          });
+          arena += '\0';
+        }
+      }
+    }
+  }
+
+  // the first dir in precedence order wins for every desktop file id,
+  // the survivors stay in discovery order
+  void dedup(void)
+  {
+    std::stable_sort(entries.begin(), entries.end(), [&](const auto &a, const auto &b) {
+      return id(a) < id(b);
+    });
+
+    const auto end = std::unique(entries.begin(), entries.end(), [&](const auto &a, const auto &b) {
+      return id(a) == id(b);
+    });
+    entries.erase(end, entries.end());
+
+    std::sort(entries.begin(), entries.end(), [](const auto &a, const auto &b) {
+      return a.id < b.id;
+    });
+  }
+};
+
+static inline void add_applications_dir(std::vector<std::string> &dirs, const std::string_view &data_dir)
+{
+  // the spec says to ignore relative paths
+  if (data_dir.empty() || data_dir[0] != '/') return;
+
+  auto dir = std::string(data_dir);
+  if (dir.back() != '/') dir += '/';
+  dir += "applications";
+
+  if (std::find(dirs.begin(), dirs.end(), dir) == dirs.end()) {
+    dirs.emplace_back(std::move(dir));
+  }
+}
+
+// the applications dir of $XDG_DATA_HOME, if any
+static inline std::vector<std::string> user_applications_dirs(void)
+{
+  std::vector<std::string> ret;
+
+  // RAPP_APPLICATIONS_DIRS replaces discovery altogether
+  if (getenv("RAPP_APPLICATIONS_DIRS")) return ret;
+
+  const char *data_home = getenv("XDG_DATA_HOME");
+  if (data_home && *data_home) {
+    add_applications_dir(ret, data_home);
+  } else if (const char *home = getenv("HOME")) {
+    add_applications_dir(ret, std::string(home) + "/.local/share");
+  }
+
+  return ret;
+}
+
+// the applications dirs of $XDG_DATA_DIRS, highest precedence first
+static inline std::vector<std::string> system_applications_dirs(void)
+{
+  std::vector<std::string> ret;
+
+  // colon separated list replacing the xdg directories, for benchmarks
+  if (const char *override = getenv("RAPP_APPLICATIONS_DIRS")) {
+    for (const auto &dir: split(override, ':')) ret.emplace_back(dir);
+    return ret;
+  }
+
+  const char *data_dirs = getenv("XDG_DATA_DIRS");
+  for (const auto &dir: split(data_dirs && *data_dirs ? data_dirs : "/usr/local/share/:/usr/share/", ':')) {
+    add_applications_dir(ret, dir);
+  }
+
+  return ret;
+}
+
+static inline void discover(discovery_t &discovery, const std::vector<std::string> &dirs)
+{
+  for (const auto &dir: dirs) {
+    const int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (discovery.walked) discovery.path = dir;
+    if (fd != -1) discovery.walk(fd);
+  }
+}
+
+// writes the system entries to path for every user's rapp to map, see
+// system-index.h
+static inline bool build_system_index(const char *path)
+{
+  const auto dirs = system_applications_dirs();
+
+  // before discovery, so that a dir changing meanwhile makes it stale
+  system_index_writer_t writer;
+
+  // subdirs too, a file added to one leaves the dirs above it unmodified
+  std::vector<std::string> walked;
+  discovery_t discovery;
+  discovery.walked = &walked;
+  discover(discovery, dirs);
+  discovery.dedup();
+  writer.add_dirs(dirs, walked);
+
+  std::string name, exec, initials;
+  for (const auto &e: discovery.entries) {
+    if (!app_t::parse(discovery.name(e), name, exec, initials, discovery.dirs[e.dir])) continue;
+    if (name.empty() || exec.empty()) continue;
+
+    writer.add(discovery.id(e), name, exec, initials);
+  }
+
+  return writer.write(path);
+}
+
+// $XDG_DATA_HOME's entries, then the system ones, from the system index when
+// there is a valid one and parsed from $XDG_DATA_DIRS otherwise
+static inline void parse_apps(void)
+{
+  std::unordered_set<std::string_view> seen_names;
+
+  discovery_t discovery;
+  discover(discovery, user_applications_dirs());
+
+  // the dirs the index was not built from are parsed, those before its own
+  // into discovery, those after them into after_index
+  discovery_t after_index;
+  const auto system_dirs = system_applications_dirs();
+  const char *index_path = getenv("RAPP_SYSTEM_INDEX");
+  if (system_index.map(index_path ? index_path : SYSTEM_INDEX_PATH, system_dirs)) {
+    // the index's dirs are a run of system_dirs, see covered()
+    auto indexed = std::find_if(system_dirs.begin(), system_dirs.end(), [](const auto &dir) {
+      return system_index.has_dir(dir);
+    });
+    discover(discovery, std::vector(system_dirs.begin(), indexed));
+    while (indexed != system_dirs.end() && system_index.has_dir(*indexed)) ++indexed;
+    discover(after_index, std::vector(indexed, system_dirs.end()));
+  } else {
+    discover(discovery, system_dirs);
+  }
+
+  discovery.dedup();
+  after_index.dedup();
+
+  // with a mapped index discovery only holds the user's entries and those
+  // of the dirs before the index's, they shadow its entries by desktop file
+  // id, and together they shadow after_index's
+  std::unordered_set<std::string_view> shadowing_ids;
+  if (system_index.mapped()) {
+    for (const auto &e: discovery.entries) shadowing_ids.insert(discovery.id(e));
+  }
+
+  // there are at most as many apps as entries, so apps never reallocates
+  // under the ui reading the entries published so far
+  apps.reserve(apps.size() + discovery.entries.size() + system_index.size() + after_index.entries.size());
+  app_initials.reserve(apps.capacity());
+
+  const auto add = [&](const std::string_view &name, const std::string_view &exec, const std::string_view &initials) {
+    if (seen_names.count(name) != 0) return;
+
+    app_initials.push_back(initials);
+    apps.push_back(app_t{name, exec});
+    seen_names.insert(name);
+    apps_ready.store(apps.size(), std::memory_order_release);
+  };
+
+  std::string name, exec, initials;
+  const auto parse = [&](const discovery_t &d, const std::unordered_set<std::string_view> &shadowed) {
+    for (const auto &e: d.entries) {
+      if (shadowed.count(d.id(e)) != 0) continue;
+      if (!app_t::parse(d.name(e), name, exec, initials, d.dirs[e.dir])) continue;
+      if (name.empty() || exec.empty()) continue;
+      if (seen_names.count(name) != 0) continue;
+
+      add(app_strings.intern(name), app_strings.intern(exec), initials_strings.intern(initials));
+    }
+  };
+
+  parse(discovery, {});
+
+  // the strings stay in the mapping
+  for (size_t i = 0; i < system_index.size(); ++i) {
+    const auto e = system_index.entry(i);
+    if (shadowing_ids.count(e.id) != 0) continue;
+    add(e.name, e.exec, e.initials);
+  }
+
+  if (after_index.entries.empty()) return;
+
+  for (size_t i = 0; i < system_index.size(); ++i) {
+    shadowing_ids.insert(system_index.entry(i).id);
+  }
+
+  parse(after_index, shadowing_ids);
+}
@@ -0,0 +1,347 @@
+#include <poll.h>
+#include <fcntl.h>
+#include <assert.h>
+#include <stdio.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <X11/Xlib.h>
+#include <X11/keysym.h>
+#include <X11/extensions/XTest.h>
+
+#include <string>
+#include <vector>
+#include <string_view>
+
+#include "corpus.h"
+
+// render loop benchmark: runs rapp on a private Xvfb server (mesa llvmpipe,
+// no gpu needed), drives it with scripted XTest input and prints the frame
+// cpu time, frame pacing and keystroke-to-frame latency rapp reports through
+// $RAPP_LATENCY as json lines. rapp lists a generated set of desktop entries
+// and history instead of the host's, so runs on different machines compare.
+
+constexpr uint64_t SEED = 0x5eed;
+constexpr size_t FIXTURE_APPS = 1000;
+
+constexpr useconds_t EVENT_INTERVAL_US = 30000;
+constexpr int STARTUP_TIMEOUT_MS = 10000;
+constexpr useconds_t STARTUP_SETTLE_US = 500000;
+
+// must match rapp.cpp
+constexpr int WINDOW_W = 800;
+constexpr int WINDOW_H = 600;
+constexpr int PROMPT_H = 40;
+
+static Display *display;
+static Window window;
+static int window_x, window_y;
+
+static pid_t spawn(const std::vector<const char *> &args, const std::vector<std::string> &env)
+{
+  const pid_t pid = fork();
+  if (pid == 0) {
+    for (const auto &e: env) putenv(strdup(e.c_str()));
+
+    const int fd = open("/dev/null", O_RDWR);
+    dup2(fd, STDIN_FILENO);
+    dup2(fd, STDOUT_FILENO);
+    close(fd);
+
+    std::vector<char *> argv;
+    for (const auto arg: args) argv.emplace_back(const_cast<char *>(arg));
+    argv.emplace_back(nullptr);
+
+    execvp(argv[0], argv.data());
+    perror("execvp failed");
+    _exit(EXIT_FAILURE);
+  }
+
+  return pid;
+}
+
+static Window find_window(Window root, const char *name)
+{
+  char *window_name = NULL;
+  if (XFetchName(display, root, &window_name) && window_name) {
+    const auto found = strcmp(window_name, name) == 0;
+    XFree(window_name);
+    if (found) return root;
+  }
+
+  Window parent, *children = NULL;
+  unsigned n = 0;
+  if (!XQueryTree(display, root, &root, &parent, &children, &n)) return 0;
+
+  Window ret = 0;
+  for (unsigned i = 0; i < n && !ret; ++i) {
+    ret = find_window(children[i], name);
+  }
+
+  if (children) XFree(children);
+  return ret;
+}
+
+static void settle(void)
+{
+  XFlush(display);
+  usleep(EVENT_INTERVAL_US);
+}
+
+static void key(KeySym sym, bool ctrl = false)
+{
+  const auto control = XKeysymToKeycode(display, XK_Control_L);
+  const auto code = XKeysymToKeycode(display, sym);
+
+  if (ctrl) XTestFakeKeyEvent(display, control, True, CurrentTime);
+  XTestFakeKeyEvent(display, code, True, CurrentTime);
+  XTestFakeKeyEvent(display, code, False, CurrentTime);
+  if (ctrl) XTestFakeKeyEvent(display, control, False, CurrentTime);
+  settle();
+}
+
+static void type(std::string_view text)
+{
+  for (const auto c: text) {
+    key(c == ' ' ? XK_space : XK_a + (c - 'a'));
+  }
+}
+
+static void erase(size_t n)
+{
+  while (n--) key(XK_BackSpace);
+}
+
+static void move_mouse(int x, int y)
+{
+  XTestFakeMotionEvent(display, -1, window_x + x, window_y + y, CurrentTime);
+  settle();
+}
+
+static void wheel(bool down, size_t n)
+{
+  while (n--) {
+    XTestFakeButtonEvent(display, down ? 5 : 4, True, CurrentTime);
+    XTestFakeButtonEvent(display, down ? 5 : 4, False, CurrentTime);
+    settle();
+  }
+}
+
+static void drag(int x, int from_y, int to_y)
+{
+  move_mouse(x, from_y);
+  XTestFakeButtonEvent(display, 1, True, CurrentTime);
+  settle();
+
+  const int step = from_y < to_y ? 10 : -10;
+  for (int y = from_y; (step > 0) ? y < to_y : y > to_y; y += step) {
+    move_mouse(x, y);
+  }
+
+  XTestFakeButtonEvent(display, 1, False, CurrentTime);
+  settle();
+}
+
+// typing, editing, list movement, wheel scrolling and a scrollbar drag
+static void run_script(void)
+{
+  const int scrollbar_x = WINDOW_W - 13;
+
+  type("fire");
+  erase(4);
+  type("term");
+  for (int i = 0; i < 3; ++i) key(XK_n, true);
+  for (int i = 0; i < 2; ++i) key(XK_p, true);
+  erase(4);
+  type("settings");
+  key(XK_a, true);
+  key(XK_k, true);
+
+  move_mouse(WINDOW_W / 2, WINDOW_H / 2);
+  wheel(true, 10);
+  wheel(false, 5);
+
+  drag(scrollbar_x, PROMPT_H + 10, WINDOW_H - 20);
+  drag(scrollbar_x, WINDOW_H - 20, PROMPT_H + 10);
+}
+
+// corpus.h names as desktop entries in home/applications, a few percent of
+// them launched before, in home's history
+static bool write_fixture(const std::string &home)
+{
+  const auto dir = home + "/applications";
+  const auto share = home + "/.local/share";
+  std::error_code ec;
+  if (!std::filesystem::create_directories(dir, ec) || !std::filesystem::create_directories(share, ec)) {
+    return false;
+  }
+
+  rng_t rng = {SEED};
+  std::string history;
+  for (size_t i = 0; i < FIXTURE_APPS; ++i) {
+    const auto name = generate_name(rng);
+    const auto entry = "[Desktop Entry]\nType=Application\nName=" + name + "\nExec=true\n";
+    if (!write_file(dir + "/" + std::to_string(i) + ".desktop", entry)) return false;
+
+    for (size_t j = rng.chance(0.05) ? 1 + rng.below(20) : 0; j > 0; --j) {
+      history += name + "\n";
+    }
+  }
+
+  return write_file(share + "/rapp_history", history);
+}
+
+// Xvfb picks a free display itself and writes its number to the pipe once
+// it accepts connections
+static pid_t start_xvfb(std::string &display_name)
+{
+  int fds[2];
+  if (pipe(fds) == -1) return -1;
+  fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+
+  const auto fd = std::to_string(fds[1]);
+  const auto pid = spawn({"Xvfb", "-displayfd", fd.c_str(), "-screen", "0", "1280x1024x24",
+                          "+extension", "GLX", "-nolisten", "tcp"}, {});
+  close(fds[1]);
+
+  char buf[16];
+  size_t len = 0;
+  struct pollfd pfd = {.fd = fds[0], .events = POLLIN, .revents = 0};
+  while (pid > 0 && len < sizeof(buf) && poll(&pfd, 1, STARTUP_TIMEOUT_MS) > 0) {
+    const auto n = read(fds[0], buf + len, sizeof(buf) - len);
+    if (n <= 0) break;
+    len += n;
+    if (memchr(buf, '\n', len)) break;
+  }
+  close(fds[0]);
+
+  const auto end = (const char *) memchr(buf, '\n', len);
+  if (end && end > buf) display_name = ":" + std::string(buf, end - buf);
+  return pid;
+}
+
+static bool wait_for_display(const char *name)
+{
+  for (int waited = 0; waited < STARTUP_TIMEOUT_MS; waited += 50) {
+    if ((display = XOpenDisplay(name))) return true;
+    usleep(50000);
+  }
+  return false;
+}
+
+static bool wait_for_window(void)
+{
+  for (int waited = 0; waited < STARTUP_TIMEOUT_MS; waited += 50) {
+    if ((window = find_window(DefaultRootWindow(display), "rapp"))) {
+      // rapp centers the window only after creating it
+      usleep(STARTUP_SETTLE_US);
+
+      Window child;
+      XTranslateCoordinates(display, window, DefaultRootWindow(display), 0, 0, &window_x, &window_y, &child);
+      XSetInputFocus(display, window, RevertToParent, CurrentTime);
+      XSync(display, False);
+      return true;
+    }
+    usleep(50000);
+  }
+  return false;
+}
+
+static void print_report(const char *path, size_t rounds)
+{
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    eprintf("rapp wrote no latency report\n");
+    return;
+  }
+
+  char line[256];
+  while (fgets(line, sizeof(line), f)) {
+    long ts;
+    char name[64];
+    unsigned long n;
+    double p50, p95, p99, max;
+    if (sscanf(line, "%ld %63[^:]: n=%lu p50=%lfms p95=%lfms p99=%lfms max=%lfms",
+               &ts, name, &n, &p50, &p95, &p99, &max) != 7) continue;
+
+    printf("{\"bench\":\"ui\",\"rounds\":%zu,\"metric\":\"%s\",\"n\":%lu,"
+           "\"p50_ms\":%.3f,\"p95_ms\":%.3f,\"p99_ms\":%.3f,\"max_ms\":%.3f}\n",
+           rounds, name, n, p50, p95, p99, max);
+  }
+
+  fclose(f);
+}
+
+int main(int argc, char **argv)
+{
+  const char *program = shift(argc, argv);
+  if (argc == 0) {
+    eprintf("usage: %s <path/to/rapp> [rounds]\n", program);
+    return 1;
+  }
+
+  const char *rapp = shift(argc, argv);
+  const size_t rounds = argc > 0 ? strtoul(shift(argc, argv), NULL, 10) : 5;
+
+  char home[] = "/tmp/rapp-bench-ui-XXXXXX";
+  if (!mkdtemp(home)) {
+    eprintf("could not create a temporary home\n");
+    return 1;
+  }
+
+  const auto report = std::string(home) + "/latency";
+
+  auto ok = write_fixture(home);
+  if (!ok) eprintf("could not write the desktop entries to %s\n", home);
+
+  std::string display_name;
+  const auto xvfb = ok ? start_xvfb(display_name) : -1;
+
+  ok = ok && xvfb > 0 && !display_name.empty() && wait_for_display(display_name.c_str());
+  if (!ok) eprintf("could not start Xvfb\n");
+
+  pid_t child = -1;
+  if (ok) {
+    child = spawn({rapp}, {
+      "DISPLAY=" + display_name,
+      "HOME=" + std::string(home),
+      "RAPP_APPLICATIONS_DIRS=" + std::string(home) + "/applications",
+      "RAPP_SYSTEM_INDEX=/nonexistent",
+      "RAPP_LATENCY=" + report,
+      "LIBGL_ALWAYS_SOFTWARE=1",
+    });
+
+    ok = child > 0 && wait_for_window();
+    if (!ok) eprintf("rapp did not map its window\n");
+  }
+
+  if (ok) {
+    for (size_t i = 0; i < rounds; ++i) run_script();
+
+    // raylib's exit key
+    key(XK_Escape);
+    waitpid(child, NULL, 0);
+    child = -1;
+
+    print_report(report.c_str(), rounds);
+  }
+
+  if (child > 0) {
+    kill(child, SIGTERM);
+    waitpid(child, NULL, 0);
+  }
+
+  if (display) XCloseDisplay(display);
+  if (xvfb > 0) {
+    kill(xvfb, SIGTERM);
+    waitpid(xvfb, NULL, 0);
+  }
+
+  std::error_code ec;
+  std::filesystem::remove_all(home, ec);
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,538 @@
+#include <fcntl.h>
+#include <malloc.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <string>
+#include <vector>
+#include <string_view>
+
+#include "corpus.h"
+#include "search.h"
+#include "providers.h"
+#include "front-coded.h"
+
+// search engine benchmarks over reproducible synthetic corpora, results are
+// printed as one json object per line so runs of different commits can be
+// diffed or loaded into anything.
+
+constexpr size_t CORPUS_SIZES[] = {100, 1000, 10000, 100000, 1000000};
+
+constexpr uint64_t SEED = 0x5eed;
+
+// stop querying an engine once it has spent this long on one corpus
+constexpr uint64_t QUERY_BUDGET_NS = 3000000000;
+
+constexpr size_t SCALING_ROUNDS = 5;
+
+constexpr size_t PATHS_ROUNDS = 5;
+
+struct engine_t {
+  const char *name;
+  void (*build)(void);
+  void (*query)(const std::string &prompt, std::vector<size_t> &out);
+};
+
+static void no_index(void) {}
+
+static void substring_query(const std::string &prompt, std::vector<size_t> &out)
+{
+  out.clear();
+  substring_scan(prompt, out);
+}
+
+static void bktree_query(const std::string &prompt, std::vector<size_t> &out)
+{
+  out.clear();
+  tree.query(prompt, 4, out);
+}
+
+static void prefix_query(const std::string &prompt, std::vector<size_t> &out)
+{
+  out.clear();
+  prefix_index.query(prompt, [&](const size_t i) { out.emplace_back(i); });
+}
+
+// build_index() goes parallel on large corpora by itself, the single
+// threaded engines stay single threaded at every size
+static void build_serial_index(void)
+{
+  build_parallel_index(1);
+}
+
+static void build_parallel_index_all_cores(void)
+{
+  build_parallel_index(std::thread::hardware_concurrency());
+}
+
+static const engine_t ENGINES[] = {
+  // every stage of search(): initials, substring, fuzzy prefix and bktree
+  {"substring",       no_index,                       substring_query},
+  {"bktree",          build_serial_index,             bktree_query},
+  {"fuzzy prefix",    build_serial_index,             prefix_query},
+  {"search",          build_serial_index,             search},
+  {"search parallel", build_parallel_index_all_cores, search},
+};
+
+static inline size_t heap_in_use(void)
+{
+  const auto info = mallinfo2();
+  return info.uordblks + info.hblkhd;
+}
+
+static void bench_search(size_t max_size)
+{
+  for (const auto size: CORPUS_SIZES) {
+    if (size > max_size) break;
+
+    generate_corpus(size, SEED + size);
+    const auto queries = generate_queries(SEED);
+
+    size_t corpus_bytes = 0;
+    for (const auto &app: apps) {
+      corpus_bytes += app.name.size() + app.exec.size() + 2 + sizeof(app);
+    }
+
+    void (*built)(void) = NULL;
+    uint64_t build_ns = 0;
+    size_t index_bytes = 0;
+
+    std::vector<size_t> out;
+    out.reserve(apps.size());
+
+    for (const auto &engine: ENGINES) {
+      if (engine.build != built) {
+        drop_index();
+
+        const auto heap = heap_in_use();
+        const auto start = metrics::now();
+        engine.build();
+        build_ns = metrics::now() - start;
+        index_bytes = heap_in_use() - heap;
+        built = engine.build;
+      }
+
+      metrics::histogram_t latency = {};
+      size_t results = 0;
+      uint64_t spent = 0;
+
+      for (size_t i = 0; spent < QUERY_BUDGET_NS; i = (i + 1) % queries.size()) {
+        const auto start = metrics::now();
+        engine.query(queries[i], out);
+        const auto elapsed = metrics::now() - start;
+
+        latency.record(elapsed);
+        spent += elapsed;
+        results += out.size();
+
+        if (i + 1 == queries.size() && latency.total >= 10 * queries.size()) break;
+      }
+
+      printf("{\"engine\":\"%s\",\"corpus\":%zu,\"corpus_bytes\":%zu,"
+             "\"build_ns\":%lu,\"index_bytes\":%zu,\"queries\":%lu,\"mean_results\":%.1f,"
+             "\"p50_ns\":%lu,\"p95_ns\":%lu,\"p99_ns\":%lu,\"max_ns\":%lu}\n",
+             engine.name,
+             size,
+             corpus_bytes,
+             engine.build == no_index ? 0 : build_ns,
+             engine.build == no_index ? 0 : index_bytes,
+             latency.total,
+             (double) results / latency.total,
+             latency.percentile(0.50),
+             latency.percentile(0.95),
+             latency.percentile(0.99),
+             latency.max);
+      fflush(stdout);
+    }
+
+    drop_index();
+  }
+}
+
+// the same corpus and queries through the chunked substring scan with 1 to
+// n threads. no BKTree is built, its stage runs on the calling thread only.
+static void bench_scaling(size_t size)
+{
+  generate_corpus(size, SEED + size);
+  const auto queries = generate_queries(SEED);
+
+  drop_index();
+  prepare_search();
+
+  std::vector<size_t> out;
+  out.reserve(apps.size());
+
+  const size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+  uint64_t serial_scan = 0;
+
+  for (size_t threads = 1; threads <= max_threads; ++threads) {
+    start_search_pool(threads);
+
+    metrics::histogram_t latency = {}, scan = {};
+    for (size_t round = 0; round < SCALING_ROUNDS; ++round) {
+      for (const auto &query: queries) {
+        const auto start = metrics::now();
+        search(query, out);
+        latency.record(metrics::now() - start);
+        scan.record(metrics::search.substring);
+      }
+    }
+
+    if (threads == 1) serial_scan = scan.percentile(0.50);
+
+    printf("{\"bench\":\"scaling\",\"corpus\":%zu,\"threads\":%zu,\"queries\":%lu,"
+           "\"scan_p50_ns\":%lu,\"scan_speedup\":%.2f,\"p50_ns\":%lu,\"p95_ns\":%lu,\"max_ns\":%lu}\n",
+           size,
+           threads,
+           latency.total,
+           scan.percentile(0.50),
+           (double) serial_scan / std::max<uint64_t>(scan.percentile(0.50), 1),
+           latency.percentile(0.50),
+           latency.percentile(0.95),
+           latency.max);
+    fflush(stdout);
+  }
+
+  drop_index();
+}
+
+// find / sized lists of paths interned into an arena the way apps are and
+// front coded: the bytes each holds and the time to find every path
+// containing a query, which must be the same paths for both.
+static int bench_paths(size_t size)
+{
+  const auto paths = generate_paths(size, SEED + size);
+
+  // the end of random paths, as if typed to find a file seen before
+  rng_t rng = {SEED};
+  std::vector<std::string> queries = {"lib", "share", ".conf", "include/", "steam"};
+  while (queries.size() < 32) {
+    const auto &path = paths[rng.below(paths.size())];
+    const auto base = path.rfind('/') + 1;
+    queries.emplace_back(path.substr(base, std::min<size_t>(2 + rng.below(5), path.size() - base)));
+  }
+
+  size_t raw_bytes = 0;
+  for (const auto &path: paths) raw_bytes += path.size();
+
+  auto heap = heap_in_use();
+  strings_t arena;
+  std::vector<std::string_view> items;
+  items.reserve(paths.size());
+  for (const auto &path: paths) items.emplace_back(arena.intern(path));
+  const auto arena_bytes = heap_in_use() - heap;
+
+  heap = heap_in_use();
+  front_coded_t coded;
+  const auto start = metrics::now();
+  coded.build(items);
+  const auto build_ns = metrics::now() - start;
+  const auto coded_bytes = heap_in_use() - heap;
+
+  metrics::histogram_t arena_scan = {}, coded_scan = {};
+  std::string buf;
+  size_t results = 0;
+
+  for (size_t round = 0; round < PATHS_ROUNDS; ++round) {
+    for (const auto &query: queries) {
+      size_t found = 0;
+      auto start = metrics::now();
+      for (const auto &item: items) found += item.find(query) != std::string_view::npos;
+      arena_scan.record(metrics::now() - start);
+
+      size_t coded_found = 0;
+      start = metrics::now();
+      coded.find(query, buf, [&](uint32_t, std::string_view, size_t) { coded_found++; });
+      coded_scan.record(metrics::now() - start);
+
+      if (found != coded_found) {
+        eprintf("%s: %zu paths in the arena, %zu front coded\n", query.c_str(), found, coded_found);
+        return 1;
+      }
+      results += found;
+    }
+  }
+
+  // the files provider over the same paths, names only and case folded
+  file_index.build(items, std::vector<uint16_t>(items.size(), 0), {FILES_FALLBACK_EXEC});
+  start_files_pool();
+
+  metrics::histogram_t files_query = {};
+  std::vector<app_t> out;
+  for (size_t round = 0; round < PATHS_ROUNDS; ++round) {
+    for (const auto &query: queries) {
+      out.clear();
+      const auto start = metrics::now();
+      query_files({}, query, out);
+      files_query.record(metrics::now() - start);
+    }
+  }
+
+  printf("{\"bench\":\"paths\",\"paths\":%zu,\"raw_bytes\":%zu,\"arena_bytes\":%zu,"
+         "\"front_coded_bytes\":%zu,\"ratio\":%.2f,\"build_ns\":%lu,\"queries\":%lu,\"mean_results\":%.1f,"
+         "\"arena_scan_p50_ns\":%lu,\"front_coded_scan_p50_ns\":%lu,\"scan_ratio\":%.2f,"
+         "\"files_query_p50_ns\":%lu,\"files_query_max_ns\":%lu,\"threads\":%zu}\n",
+         paths.size(),
+         raw_bytes,
+         arena_bytes,
+         coded_bytes,
+         (double) arena_bytes / std::max<size_t>(coded_bytes, 1),
+         build_ns,
+         arena_scan.total,
+         (double) results / arena_scan.total,
+         arena_scan.percentile(0.50),
+         coded_scan.percentile(0.50),
+         (double) coded_scan.percentile(0.50) / std::max<uint64_t>(arena_scan.percentile(0.50), 1),
+         files_query.percentile(0.50),
+         files_query.max,
+         file_index.pool.size());
+  return 0;
+}
+
+// a .desktop file the size of a real one: translations for a fraction of
+// the entries run into tens of kilobytes, and about half carry actions.
+static std::string generate_desktop_file(rng_t &rng, const std::string &name)
+{
+  static const char *LOCALES[] = {
+    "ar", "bg", "ca", "cs", "da", "de", "el", "en_GB", "es", "et", "eu", "fi",
+    "fr", "gl", "he", "hr", "hu", "id", "it", "ja", "ko", "lt", "nb", "nl",
+    "pl", "pt", "pt_BR", "ro", "ru", "sk", "sl", "sr", "sv", "tr", "uk", "vi",
+    "zh_CN", "zh_TW",
+  };
+
+  const size_t locales = rng.chance(0.4) ? std::size(LOCALES) : rng.below(6);
+  const auto translated = [&](const char *key, const std::string &value) {
+    std::string ret = std::string(key) + "=" + value + "\n";
+    for (size_t i = 0; i < locales; ++i) {
+      ret += std::string(key) + "[" + LOCALES[i] + "]=" + value + " (" + LOCALES[i] + ")\n";
+    }
+    return ret;
+  };
+
+  std::string bin = name;
+  for (auto &c: bin) if (c == ' ' || c == '.') c = '-';
+
+  std::string ret = "[Desktop Entry]\nVersion=1.0\nType=Application\n";
+  ret += translated("Name", name);
+  ret += translated("GenericName", generate_name(rng));
+  ret += translated("Comment", generate_name(rng) + " " + generate_name(rng));
+  ret += translated("Keywords", generate_name(rng) + ";" + generate_name(rng) + ";");
+  ret += "Exec=" + bin + " %U\nIcon=" + bin + "\nTerminal=false\n";
+  ret += "Categories=Utility;Development;\nStartupNotify=true\n";
+
+  if (rng.chance(0.5)) {
+    ret += "Actions=new-window;new-private-window;\n";
+    ret += "\n[Desktop Action new-window]\n" + translated("Name", "new window");
+    ret += "Exec=" + bin + " --new-window\n";
+    ret += "\n[Desktop Action new-private-window]\n" + translated("Name", "new private window");
+    ret += "Exec=" + bin + " --private-window\n";
+  }
+
+  return ret;
+}
+
+struct tree_t {
+  std::string root, history, index;
+  std::vector<std::string> files;
+  size_t bytes;
+};
+
+static bool generate_tree(tree_t &tree, size_t n)
+{
+  char root[] = "/tmp/rapp-bench-XXXXXX";
+  if (!mkdtemp(root)) return false;
+
+  tree.root = root;
+  const auto dir = tree.root + "/applications";
+  fs::create_directory(dir);
+
+  rng_t rng = {SEED + n};
+  std::string history;
+  for (size_t i = 0; i < n; ++i) {
+    const auto name = generate_name(rng);
+    const auto content = generate_desktop_file(rng, name);
+    const auto path = dir + "/" + std::to_string(i) + ".desktop";
+    if (!write_file(path, content)) return false;
+
+    tree.files.emplace_back(path);
+    tree.bytes += content.size();
+
+    for (size_t j = rng.chance(0.05) ? 1 + rng.below(20) : 0; j > 0; --j) {
+      history += name + "\n";
+    }
+  }
+
+  tree.history = tree.root + "/rapp_history";
+  tree.files.emplace_back(tree.history);
+  if (!write_file(tree.history, history)) return false;
+
+  // what rapp --build-system-index writes for these dirs
+  tree.index = tree.root + "/index";
+  tree.files.emplace_back(tree.index);
+  setenv("RAPP_APPLICATIONS_DIRS", dir.c_str(), 1);
+  const auto ok = build_system_index(tree.index.c_str());
+  unsetenv("RAPP_APPLICATIONS_DIRS");
+  return ok;
+}
+
+// evict the generated files from the page cache, so the next load reads
+// them from disk
+static void drop_page_cache(const tree_t &tree)
+{
+  for (const auto &path: tree.files) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) continue;
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+  }
+}
+
+struct startup_t {
+  uint64_t parse_apps, build_index, parse_ranks;
+  size_t apps, heap_bytes;
+};
+
+// how the system entries are loaded: parsing every .desktop file, or
+// mapping the index rapp --build-system-index writes
+enum loader_t {
+  LOADER_PARSE,
+  LOADER_INDEX,
+};
+
+// every load runs in a fresh child, exactly as a new rapp process would
+static bool load_in_child(const tree_t &tree, loader_t loader, startup_t &ret)
+{
+  int fds[2];
+  if (pipe(fds) == -1) return false;
+
+  const pid_t pid = fork();
+  if (pid == 0) {
+    close(fds[0]);
+
+    const auto dirs = tree.root + "/applications";
+    setenv("RAPP_APPLICATIONS_DIRS", dirs.c_str(), 1);
+    setenv("RAPP_SYSTEM_INDEX", loader == LOADER_INDEX ? tree.index.c_str() : "/nonexistent", 1);
+
+    startup_t s;
+    const auto heap = heap_in_use();
+    auto start = metrics::now();
+    parse_apps();
+    s.parse_apps = metrics::now() - start;
+    s.heap_bytes = heap_in_use() - heap;
+
+    start = metrics::now();
+    build_index();
+    s.build_index = metrics::now() - start;
+
+    start = metrics::now();
+    parse_ranks(tree.history);
+    s.parse_ranks = metrics::now() - start;
+
+    s.apps = apps.size();
+    _exit(write(fds[1], &s, sizeof(s)) == sizeof(s) ? 0 : 1);
+  }
+
+  close(fds[1]);
+  const auto ok = pid > 0 && read(fds[0], &ret, sizeof(ret)) == sizeof(ret);
+  close(fds[0]);
+  if (pid > 0) waitpid(pid, NULL, 0);
+  return ok;
+}
+
+static int bench_startup(size_t n, size_t runs)
+{
+  tree_t tree = {};
+  if (!generate_tree(tree, n)) {
+    eprintf("could not generate applications tree in /tmp\n");
+    return 1;
+  }
+
+  for (const auto &[loader, loader_name]: {
+    std::pair{LOADER_PARSE, "mmap"},
+    std::pair{LOADER_INDEX, "system-index"},
+  })
+  for (const auto cold: {true, false}) {
+    metrics::histogram_t parse = {}, index = {}, history = {}, total = {};
+    size_t loaded = 0, heap_bytes = 0;
+
+    // the first warm load only fills the page cache
+    for (size_t i = 0; i < runs + !cold; ++i) {
+      if (cold) drop_page_cache(tree);
+
+      startup_t s;
+      if (!load_in_child(tree, loader, s)) {
+        eprintf("startup benchmark child failed\n");
+        return 1;
+      }
+
+      if (!cold && i == 0) continue;
+
+      parse.record(s.parse_apps);
+      index.record(s.build_index);
+      history.record(s.parse_ranks);
+      total.record(s.parse_apps + s.build_index + s.parse_ranks);
+      loaded = s.apps;
+      heap_bytes = s.heap_bytes;
+    }
+
+    for (const auto &[stage, h]: {
+      std::pair{"parse_apps", &parse},
+      std::pair{"build_index", &index},
+      std::pair{"parse_ranks", &history},
+      std::pair{"total", &total},
+    }) {
+      printf("{\"bench\":\"startup\",\"loader\":\"%s\",\"cache\":\"%s\",\"files\":%zu,"
+             "\"bytes\":%zu,\"apps\":%zu,\"heap_bytes\":%zu,\"stage\":\"%s\",\"runs\":%lu,"
+             "\"p50_ns\":%lu,\"p95_ns\":%lu,\"max_ns\":%lu}\n",
+             loader_name,
+             cold ? "cold" : "warm",
+             n,
+             tree.bytes,
+             loaded,
+             heap_bytes,
+             stage,
+             h->total,
+             h->percentile(0.50),
+             h->percentile(0.95),
+             h->max);
+    }
+    fflush(stdout);
+  }
+
+  fs::remove_all(tree.root);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  const char *program = shift(argc, argv);
+
+  const std::string_view mode = argc > 0 ? shift(argc, argv) : "search";
+  if (mode == "search") {
+    const size_t max_size = argc > 0 ? strtoul(shift(argc, argv), NULL, 10) : SIZE_MAX;
+    bench_search(max_size);
+    return 0;
+  }
+
+  if (mode == "scaling") {
+    const size_t size = argc > 0 ? strtoul(shift(argc, argv), NULL, 10) : 1000000;
+    bench_scaling(size);
+    return 0;
+  }
+
+  if (mode == "paths") {
+    const size_t size = argc > 0 ? strtoul(shift(argc, argv), NULL, 10) : 1000000;
+    return bench_paths(size ? size : 1);
+  }
+
+  if (mode == "startup") {
+    const size_t n = argc > 0 ? strtoul(shift(argc, argv), NULL, 10) : 1000;
+    const size_t runs = argc > 0 ? strtoul(shift(argc, argv), NULL, 10) : 10;
+    return bench_startup(n, runs ? runs : 1);
+  }
+
+  eprintf("usage: %s [search [max_corpus_size]] | [scaling [corpus_size]] | [paths [paths]] | [startup [files [runs]]]\n", program);
+  return 1;
+}
@@ -1,2 +1,12 @@
 c++ -std=gnu++20 -Wno-missing-field-initializers -Ithirdparty/raylib/include -Wall -Wextra -Wpedantic -O3 -DNDEBUG -static-libstdc++ -MD -MF build/rapp-release.o.d -o build/rapp-release.o -c rapp.cpp
-c++ -std=gnu++20 -Wno-missing-field-initializers -Ithirdparty/raylib/include -Wall -Wextra -Wpedantic -O3 -DNDEBUG -static-libstdc++ -o build/rapp-release build/rapp-release.o -L./thirdparty/raylib/lib -l:'libraylib.a' -lX11
+c++ -std=gnu++20 -Wno-missing-field-initializers -Ithirdparty/raylib/include -Wall -Wextra -Wpedantic -O3 -DNDEBUG -static-libstdc++ -o build/rapp-release build/rapp-release.o -L./thirdparty/raylib/lib -l:'libraylib.a' -lX11 -pthread
+
+if [ "$1" = "bench" ]; then
+  c++ -std=gnu++20 -Wno-missing-field-initializers -Ithirdparty/raylib/include -Wall -Wextra -Wpedantic -O3 -DNDEBUG -static-libstdc++ -MD -MF build/bench.o.d -o build/bench.o -c bench.cpp
+  c++ -std=gnu++20 -Wno-missing-field-initializers -Ithirdparty/raylib/include -Wall -Wextra -Wpedantic -O3 -DNDEBUG -static-libstdc++ -o build/bench build/bench.o -pthread
+fi
+
+if [ "$1" = "fuzz" ]; then
+  c++ -std=gnu++20 -Wno-missing-field-initializers -Ithirdparty/raylib/include -Wall -Wextra -Wpedantic -O1 -g -fsanitize=address,undefined -MD -MF build/fuzz.o.d -o build/fuzz.o -c fuzz.cpp
+  c++ -std=gnu++20 -Wno-missing-field-initializers -Ithirdparty/raylib/include -Wall -Wextra -Wpedantic -O1 -g -fsanitize=address,undefined -o build/fuzz build/fuzz.o -pthread
+fi
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <vector>
+#include <string_view>
+
+#include "apps.h"
+
+// ghost text: the rest of the most launched app whose name starts with the
+// prompt. the launched names go into a trie where every node remembers the
+// best app below it, so a lookup walks one node per prompt character and
+// never looks past the prompt.
+
+struct completion_trie_t {
+  static constexpr uint32_t NO_APP = UINT32_MAX;
+
+  // siblings are a linked list, a node has as many as there are distinct
+  // characters after its prefix. node 0 is the root, which is nobody's
+  // child or sibling, so 0 ends a list.
+  struct node_t {
+    uint32_t child, sibling;
+    uint32_t best;
+    char c;
+  };
+
+  std::vector<node_t> nodes;
+
+  void build(void)
+  {
+    nodes.clear();
+    nodes.push_back({0, 0, NO_APP, 0});
+
+    for (size_t i = 0; i < apps.size(); ++i) {
+      if (app_ranks[i]) insert(i);
+    }
+  }
+
+  void insert(size_t app)
+  {
+    uint32_t node = 0;
+    for (const auto c: apps[app].name) {
+      uint32_t next = find(node, c);
+      if (next == 0) {
+        next = nodes.size();
+        nodes.push_back({0, nodes[node].child, NO_APP, c});
+        nodes[node].child = next;
+      }
+
+      node = next;
+      if (nodes[node].best == NO_APP || ranked_before(app, nodes[node].best)) {
+        nodes[node].best = app;
+      }
+    }
+  }
+
+  inline uint32_t find(uint32_t node, char c) const noexcept
+  {
+    for (uint32_t child = nodes[node].child; child; child = nodes[child].sibling) {
+      if (nodes[child].c == c) return child;
+    }
+    return 0;
+  }
+
+  // nul terminated, empty when no launched name starts with prefix
+  std::string_view complete(const std::string_view &prefix) const noexcept
+  {
+    if (nodes.empty() || prefix.empty()) return {};
+
+    uint32_t node = 0;
+    for (const auto c: prefix) {
+      if (!(node = find(node, c))) return {};
+    }
+
+    return apps[nodes[node].best].name.substr(prefix.size());
+  }
+};
+
+static completion_trie_t completions;
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "apps.h"
+
+// reproducible synthetic application names, histories and typed queries,
+// shared by the benchmarks and the search differential test.
+
+struct rng_t {
+  uint64_t state;
+
+  // splitmix64
+  inline uint64_t next(void) noexcept
+  {
+    uint64_t z = (state += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+  }
+
+  inline size_t below(size_t n) noexcept
+  {
+    return next() % n;
+  }
+
+  inline bool chance(double p) noexcept
+  {
+    return (next() >> 11) * 0x1.0p-53 < p;
+  }
+};
+
+// vendor prefixes shared by whole families of entries, as in real
+// applications directories
+static const char *PREFIXES[] = {
+  "gnome ", "kde ", "libreoffice ", "org.kde.", "org.gnome.", "xfce4 ",
+  "qt ", "gtk ", "wine ", "steam ", "jetbrains ", "visual studio ",
+};
+
+static const char *SYLLABLES[] = {
+  "fi", "re", "fox", "ter", "mi", "nal", "vi", "su", "al", "stu", "dio",
+  "code", "of", "ce", "calc", "wri", "im", "press", "draw", "set", "tings",
+  "mo", "ni", "tor", "sys", "tem", "edit", "or", "view", "er", "play", "ma",
+  "na", "ger", "files", "chro", "um", "thun", "der", "bird", "blen", "krit",
+  "a", "in", "kscape", "gimp", "vlc", "mpv", "ob", "s", "dol", "phin", "kon",
+  "sole", "steam", "disk", "us", "age", "net", "work", "blue", "tooth",
+};
+
+template<typename T, size_t N>
+static inline const T &pick(rng_t &rng, const T (&items)[N])
+{
+  return items[rng.below(N)];
+}
+
+static inline std::string generate_name(rng_t &rng)
+{
+  std::string name;
+
+  if (rng.chance(0.35)) {
+    name += pick(rng, PREFIXES);
+  }
+
+  // mostly one or two words of one to three syllables
+  const size_t words = 1 + rng.chance(0.45) + rng.chance(0.15);
+  for (size_t w = 0; w < words; ++w) {
+    if (w > 0) name += ' ';
+    const size_t syllables = 1 + rng.below(3);
+    for (size_t s = 0; s < syllables; ++s) {
+      name += pick(rng, SYLLABLES);
+    }
+  }
+
+  return name;
+}
+
+static inline void generate_corpus(size_t n, uint64_t seed)
+{
+  rng_t rng = {seed};
+
+  ranks.clear();
+  apps.clear();
+  app_strings.clear();
+  apps.reserve(n);
+  for (size_t i = 0; i < n; ++i) {
+    apps.push_back(app_t{app_strings.intern(generate_name(rng)), "true"});
+  }
+
+  // a launch history covering a few percent of the entries
+  for (size_t i = 0; i < n / 20 + 1; ++i) {
+    ranks[apps[rng.below(n)].name] += 1 + rng.below(50);
+  }
+
+  rank_apps();
+}
+
+// the output of find / over a synthetic tree: every directory followed by
+// its entries depth first in readdir order, most of them files.
+static const char *ROOTS[] = {
+  "/usr/share", "/usr/lib", "/usr/include", "/home/user", "/var/lib", "/opt", "/etc",
+};
+
+static const char *EXTENSIONS[] = {
+  ".c", ".h", ".so", ".png", ".svg", ".conf", ".txt", ".py", ".desktop", ".mo", "",
+};
+
+static inline void generate_dir(rng_t &rng, std::string &path, size_t depth, size_t n, std::vector<std::string> &out)
+{
+  const size_t entries = 1 + rng.below(24);
+  for (size_t i = 0; i < entries && out.size() < n; ++i) {
+    const auto len = path.size();
+
+    path += '/';
+    const size_t syllables = 1 + rng.below(3);
+    for (size_t s = 0; s < syllables; ++s) {
+      path += pick(rng, SYLLABLES);
+    }
+
+    if (depth < 10 && rng.chance(0.15)) {
+      out.push_back(path);
+      generate_dir(rng, path, depth + 1, n, out);
+    } else {
+      if (rng.chance(0.3)) path += std::to_string(rng.below(100));
+      path += pick(rng, EXTENSIONS);
+      out.push_back(path);
+    }
+
+    path.resize(len);
+  }
+}
+
+static inline std::vector<std::string> generate_paths(size_t n, uint64_t seed)
+{
+  rng_t rng = {seed};
+  std::vector<std::string> paths;
+  paths.reserve(n);
+
+  std::string path;
+  while (paths.size() < n) {
+    path = pick(rng, ROOTS);
+    paths.push_back(path);
+    generate_dir(rng, path, 0, n, paths);
+  }
+
+  return paths;
+}
+
+// fixtures for the benchmarks, written in one go
+static inline bool write_file(const std::string &path, const std::string &content)
+{
+  const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) return false;
+  const auto ok = write(fd, content.data(), content.size()) == (ssize_t) content.size();
+  close(fd);
+  return ok;
+}
+
+// what a user would type: prefixes of existing names typed one character
+// at a time, some of them with a typo, and a few fixed words.
+static inline std::vector<std::string> generate_queries(uint64_t seed)
+{
+  constexpr size_t SEQUENCES = 16;
+  constexpr size_t MAX_TYPED = 12;
+
+  rng_t rng = {seed};
+  std::vector<std::string> targets = {"firefox", "terminal", "settings", "libreoffice writer"};
+
+  for (size_t i = 0; i < SEQUENCES; ++i) {
+    auto target = std::string(apps[rng.below(apps.size())].name);
+    if (target.size() > 2 && rng.chance(0.25)) {
+      target[1 + rng.below(target.size() - 1)] = 'a' + rng.below(26);
+    }
+    targets.emplace_back(target);
+  }
+
+  std::vector<std::string> queries;
+  for (const auto &target: targets) {
+    for (size_t n = 1; n <= std::min(target.size(), MAX_TYPED); ++n) {
+      queries.emplace_back(target.substr(0, n));
+    }
+  }
+
+  return queries;
+}
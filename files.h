@@ -0,0 +1,831 @@
+#pragma once
+
+#include <poll.h>
+#include <fcntl.h>
+#include <ctype.h>
+#include <errno.h>
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <string_view>
+#include <unordered_map>
+#include <condition_variable>
+
+#include "apps.h"
+#include "pool.h"
+#include "front-coded.h"
+#include "system-index.h"
+
+// the files below $RAPP_FILES_ROOT ($HOME by default) for the "files"
+// provider. a crawl walks the tree on FILES_CRAWL_THREADS threads, skipping
+// hidden entries (unless $RAPP_FILES_HIDDEN is set), the dir names in
+// $RAPP_FILES_SKIP (comma separated, FILES_SKIP by default) and whatever
+// the .gitignore and .ignore files on the way match. the paths are front
+// coded together with the command that opens each, resolved from the mime
+// associations while indexing, and written to ~/.cache/rapp_files for the
+// next rapp to read back instead of crawling. an index older than
+// FILES_INDEX_MAX_AGE_NS, or than the root or a dir right below it, still
+// answers while a crawl replaces it in the background. `rapp
+// --files-daemon` keeps that file current: it watches every crawled dir
+// with inotify and crawls again once changes settle, and at least every
+// FILES_REFRESH_MS.
+
+constexpr const char *FILES_SKIP = "node_modules,__pycache__";
+
+constexpr uint32_t FILES_INDEX_MAGIC = 0x4C494652; // "RFIL"
+constexpr uint32_t FILES_INDEX_VERSION = 1;
+
+// the crawl waits on the disk far more than on the cpu
+constexpr size_t FILES_CRAWL_THREADS = 8;
+constexpr size_t FILES_DENTS_BUF_SIZE = 32 * 1024;
+
+constexpr size_t FILES_PARALLEL_MIN = 65536;
+constexpr size_t FILES_CHUNK = 16384;
+
+constexpr int FILES_DEBOUNCE_MS = 2000;
+
+// the daemon crawls well before an index it wrote expires
+constexpr uint64_t FILES_INDEX_MAX_AGE_NS = 24ull * 3600 * 1000000000;
+constexpr int FILES_REFRESH_MS = 12 * 3600 * 1000;
+
+// opens anything no mime association covers
+constexpr const char *FILES_FALLBACK_EXEC = "xdg-open %f";
+
+struct files_config_t {
+  std::string root;
+  std::vector<std::string> skip;
+  bool hidden;
+
+  bool skipped(const char *name) const
+  {
+    if (name[0] == '.' && !hidden) return true;
+    return std::find(skip.begin(), skip.end(), name) != skip.end();
+  }
+
+  // a different config makes an index written under another one stale
+  uint64_t hash(void) const
+  {
+    std::vector<std::string> parts = {root, hidden ? "hidden" : ""};
+    parts.insert(parts.end(), skip.begin(), skip.end());
+    return hash_dirs(parts);
+  }
+};
+
+static inline files_config_t files_config(void)
+{
+  files_config_t ret = {};
+
+  const char *root = getenv("RAPP_FILES_ROOT");
+  if (!root) root = getenv("HOME");
+  ret.root = root ? root : "/";
+  while (ret.root.size() > 1 && ret.root.back() == '/') ret.root.pop_back();
+
+  const char *skip = getenv("RAPP_FILES_SKIP");
+  for (const auto &name: split(skip ? skip : FILES_SKIP, ',')) ret.skip.emplace_back(name);
+
+  ret.hidden = getenv("RAPP_FILES_HIDDEN") != NULL;
+  return ret;
+}
+
+static inline std::string files_index_path(void)
+{
+  if (const char *path = getenv("RAPP_FILES_INDEX")) return path;
+
+  const char *home = getenv("HOME");
+  return std::string(home ? home : "") + "/.cache/rapp_files";
+}
+
+// the patterns of the .gitignore and .ignore files of one dir, which apply
+// to everything below it as well. a pattern with a '/' before its end
+// matches the path relative to the dir, any other one the entry name.
+// negations are not supported and skipped.
+struct ignore_t {
+  struct pattern_t {
+    std::string glob;
+    bool dir_only, relative;
+  };
+
+  std::shared_ptr<const ignore_t> parent;
+  std::string dir;
+  std::vector<pattern_t> patterns;
+
+  void parse(const std::string_view &file)
+  {
+    for (auto line: split(file, '\n')) {
+      while (!line.empty() && isspace((uint8_t) line.back())) line.remove_suffix(1);
+      if (line.empty() || line[0] == '#' || line[0] == '!') continue;
+
+      pattern_t pattern = {};
+      if (line.back() == '/') {
+        pattern.dir_only = true;
+        line.remove_suffix(1);
+      }
+      if (line.starts_with("**/")) line.remove_prefix(3);
+
+      pattern.relative = line.find('/') != std::string_view::npos;
+      if (line[0] == '/') line.remove_prefix(1);
+      if (line.empty()) continue;
+
+      pattern.glob = line;
+      patterns.emplace_back(std::move(pattern));
+    }
+  }
+
+  // path is below dir and ends with name
+  static bool matches(const ignore_t *ignore, const std::string &path, const char *name, bool is_dir)
+  {
+    for (; ignore; ignore = ignore->parent.get()) {
+      for (const auto &p: ignore->patterns) {
+        if (p.dir_only && !is_dir) continue;
+
+        const auto ok = p.relative
+          ? fnmatch(p.glob.c_str(), path.c_str() + ignore->dir.size() + (ignore->dir.back() != '/'), FNM_PATHNAME) == 0
+          : fnmatch(p.glob.c_str(), name, 0) == 0;
+        if (ok) return true;
+      }
+    }
+    return false;
+  }
+};
+
+// the paths one crawl thread found, in the order it found them
+struct crawled_t {
+  strings_t strings;
+  std::vector<std::string_view> paths;
+  std::vector<uint8_t> dirs;
+};
+
+struct crawl_t {
+  struct dir_t {
+    std::string path;
+    std::shared_ptr<const ignore_t> ignore;
+  };
+
+  const files_config_t &config;
+  int inotify_fd;
+
+  // set from another thread to give up, out is then only part of the tree
+  const std::atomic<bool> *cancel;
+
+  std::mutex mutex;
+  std::condition_variable pending;
+  std::vector<dir_t> queue;
+  size_t busy = 0;
+
+  std::vector<crawled_t> out;
+  std::atomic<bool> watches_full = false;
+
+  crawl_t(const files_config_t &config, int inotify_fd, const std::atomic<bool> *cancel)
+    : config(config), inotify_fd(inotify_fd), cancel(cancel) {}
+
+  inline bool cancelled(void) const noexcept
+  {
+    return cancel && cancel->load(std::memory_order_relaxed);
+  }
+
+  // workers take dirs until none are left and no worker could add more
+  void work(size_t worker)
+  {
+    std::unique_lock lock(mutex);
+    while (true) {
+      pending.wait(lock, [&] { return !queue.empty() || busy == 0; });
+      if (queue.empty() || cancelled()) return;
+
+      auto dir = std::move(queue.back());
+      queue.pop_back();
+      busy++;
+
+      lock.unlock();
+      walk(dir, out[worker]);
+      lock.lock();
+
+      if (--busy == 0 && queue.empty()) pending.notify_all();
+    }
+  }
+
+  void run(void)
+  {
+    pool_t pool;
+    pool.start(FILES_CRAWL_THREADS);
+
+    out.resize(pool.size());
+    queue.push_back({config.root, NULL});
+    pool.run([this](size_t worker) { work(worker); });
+  }
+
+  std::shared_ptr<const ignore_t> read_ignores(int fd, const dir_t &dir)
+  {
+    std::shared_ptr<ignore_t> ignore;
+    for (const auto *file_name: {".gitignore", ".ignore"}) {
+      auto ok = true;
+      const auto file = file_t::read(file_name, &ok, fd);
+      if (file.size == 0) continue;
+
+      if (!ignore) {
+        ignore = std::make_shared<ignore_t>();
+        ignore->parent = dir.ignore;
+        ignore->dir = dir.path;
+      }
+      ignore->parse(file.sv);
+    }
+
+    if (!ignore || ignore->patterns.empty()) return dir.ignore;
+    return ignore;
+  }
+
+  void walk(const dir_t &dir, crawled_t &crawled)
+  {
+    const int fd = open(dir.path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) return;
+
+    if (inotify_fd != -1) {
+      const auto mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR;
+      if (inotify_add_watch(inotify_fd, dir.path.c_str(), mask) == -1 && errno == ENOSPC) {
+        if (!watches_full.exchange(true)) {
+          eprintf("out of inotify watches, raise fs.inotify.max_user_watches to watch all of %s\n",
+                  config.root.c_str());
+        }
+      }
+    }
+
+    const auto ignore = read_ignores(fd, dir);
+    std::vector<dir_t> subdirs;
+    std::string path;
+
+    alignas(struct dirent64) char buf[FILES_DENTS_BUF_SIZE];
+
+    ssize_t n;
+    while (!cancelled() && (n = getdents64(fd, buf, sizeof(buf))) > 0) {
+      for (ssize_t off = 0; off < n;) {
+        const auto *d = (const struct dirent64 *) (buf + off);
+        off += d->d_reclen;
+
+        const char *name = d->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+        if (config.skipped(name)) continue;
+
+        // symlinks are listed but not followed, so the crawl can not loop
+        auto type = d->d_type;
+        if (type == DT_UNKNOWN) {
+          struct stat st;
+          if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == -1) continue;
+          type = S_ISDIR(st.st_mode) ? DT_DIR : DT_REG;
+        }
+
+        path = dir.path;
+        if (path.back() != '/') path += '/';
+        path += name;
+
+        const bool is_dir = type == DT_DIR;
+        if (ignore_t::matches(ignore.get(), path, name, is_dir)) continue;
+
+        crawled.paths.emplace_back(crawled.strings.intern(path));
+        crawled.dirs.emplace_back(is_dir);
+        if (is_dir) subdirs.push_back({path, ignore});
+      }
+    }
+
+    close(fd);
+
+    if (subdirs.empty()) return;
+
+    {
+      std::lock_guard lock(mutex);
+      for (auto &subdir: subdirs) queue.emplace_back(std::move(subdir));
+    }
+    pending.notify_all();
+  }
+};
+
+// the command opening each kind of file: the extension's mime type from the
+// shared mime info globs, the mime type's default application from the
+// mimeapps.list files, its Exec from the desktop entry
+struct mime_handlers_t {
+  std::unordered_map<std::string, std::string> mime_of_ext;
+  std::unordered_map<std::string, std::vector<std::string>> apps_of_mime;
+
+  // execs[0] is FILES_FALLBACK_EXEC
+  std::vector<std::string> execs = {FILES_FALLBACK_EXEC};
+  std::unordered_map<std::string, uint16_t> handler_of_mime, handler_of_ext;
+
+  std::vector<std::string> app_dirs;
+
+  void load(void)
+  {
+    const char *data_home = getenv("XDG_DATA_HOME");
+    const char *home = getenv("HOME");
+    const auto user_data = data_home && *data_home ? std::string(data_home) : std::string(home ? home : "") + "/.local/share";
+
+    const char *data_dirs = getenv("XDG_DATA_DIRS");
+    std::vector<std::string> data = {user_data};
+    for (const auto &dir: split(data_dirs && *data_dirs ? data_dirs : "/usr/local/share/:/usr/share/", ':')) {
+      data.emplace_back(dir);
+    }
+
+    for (const auto &dir: data) parse_globs(dir + "/mime/globs2");
+
+    const char *config_home = getenv("XDG_CONFIG_HOME");
+    const char *config_dirs = getenv("XDG_CONFIG_DIRS");
+    std::vector<std::string> lists = {
+      (config_home && *config_home ? std::string(config_home) : std::string(home ? home : "") + "/.config") + "/mimeapps.list",
+    };
+    for (const auto &dir: split(config_dirs && *config_dirs ? config_dirs : "/etc/xdg", ':')) {
+      lists.emplace_back(std::string(dir) + "/mimeapps.list");
+    }
+    for (const auto &dir: data) lists.emplace_back(dir + "/applications/mimeapps.list");
+    for (const auto &dir: data) lists.emplace_back(dir + "/applications/defaults.list");
+
+    // the defaults of every list come before the added associations
+    for (const auto &list: lists) parse_mimeapps(list, "[Default Applications]");
+    for (const auto &list: lists) parse_mimeapps(list, "[Added Associations]");
+
+    app_dirs = user_applications_dirs();
+    for (auto &dir: system_applications_dirs()) app_dirs.emplace_back(std::move(dir));
+  }
+
+  // "weight:type:glob[:flags]", sorted by weight, the first dir wins
+  void parse_globs(const std::string &path)
+  {
+    auto ok = true;
+    const auto file = file_t::read(path.c_str(), &ok);
+    if (file.size == 0) return;
+
+    for (const auto &line: split(file.sv, '\n')) {
+      if (line.empty() || line[0] == '#') continue;
+
+      const auto fields = split(line, ':');
+      if (fields.size() < 3) continue;
+
+      const auto glob = fields[2];
+      if (!glob.starts_with("*.") || glob.find_first_of("*?[", 2) != std::string_view::npos) continue;
+
+      auto ext = std::string(glob.substr(2));
+      for (auto &c: ext) c = tolower(c);
+      mime_of_ext.try_emplace(std::move(ext), fields[1]);
+    }
+  }
+
+  void parse_mimeapps(const std::string &path, const std::string_view &group)
+  {
+    auto ok = true;
+    const auto file = file_t::read(path.c_str(), &ok);
+    if (file.size == 0) return;
+
+    bool in_group = false;
+    for (const auto &line: split(file.sv, '\n')) {
+      if (line.starts_with('[')) {
+        in_group = line == group;
+        continue;
+      }
+      if (!in_group) continue;
+
+      const auto eq = line.find('=');
+      if (eq == std::string_view::npos) continue;
+
+      auto &ids = apps_of_mime[std::string(line.substr(0, eq))];
+      for (const auto &id: split(line.substr(eq + 1), ';')) ids.emplace_back(id);
+    }
+  }
+
+  // the Exec of the first desktop file id that exists, empty if none does
+  std::string exec_of(const std::vector<std::string> &ids) const
+  {
+    std::string name, exec, initials;
+    for (const auto &id: ids) {
+      for (const auto &dir: app_dirs) {
+        const auto path = dir + '/' + id;
+        if (access(path.c_str(), R_OK) == -1) continue;
+        if (app_t::parse(path.c_str(), name, exec, initials) && !exec.empty()) return exec;
+      }
+    }
+    return {};
+  }
+
+  uint16_t handler_of(const std::string &mime)
+  {
+    const auto [it, added] = handler_of_mime.try_emplace(mime, 0);
+    if (!added) return it->second;
+
+    const auto apps = apps_of_mime.find(mime);
+    if (apps == apps_of_mime.end()) return 0;
+
+    const auto exec = exec_of(apps->second);
+    if (exec.empty() || execs.size() > UINT16_MAX) return 0;
+
+    const auto found = std::find(execs.begin(), execs.end(), exec);
+    it->second = found - execs.begin();
+    if (found == execs.end()) execs.emplace_back(exec);
+    return it->second;
+  }
+
+  uint16_t handler(const std::string_view &path, bool is_dir)
+  {
+    if (is_dir) return handler_of("inode/directory");
+
+    const auto slash = path.rfind('/');
+    const auto dot = path.rfind('.');
+    if (dot == std::string_view::npos || (slash != std::string_view::npos && dot < slash)) return 0;
+
+    auto ext = std::string(path.substr(dot + 1));
+    for (auto &c: ext) c = tolower(c);
+
+    const auto [it, added] = handler_of_ext.try_emplace(ext, 0);
+    if (!added) return it->second;
+
+    const auto mime = mime_of_ext.find(ext);
+    if (mime != mime_of_ext.end()) it->second = handler_of(mime->second);
+    return it->second;
+  }
+};
+
+struct files_index_header_t {
+  uint32_t magic, version;
+  uint64_t config_hash;
+  uint64_t built;           // CLOCK_REALTIME ns, taken before the crawl
+  uint32_t paths_len;
+  uint32_t bytes_size;
+  uint32_t execs_size;
+};
+
+// the paths front coded, for every path the command that opens it. queries
+// match names, the part of a path after its last '/', which are kept apart
+// lowercased and nul terminated in one buffer in the sorted order of the
+// paths, so a query is a memmem() over it rather than decoding every path.
+struct file_index_t {
+  front_coded_t paths;
+  std::vector<uint16_t> handlers;
+
+  // name_at[i] is where the name of the i-th path in sorted order starts,
+  // name_at[size()] is names.size()
+  std::string names;
+  std::vector<uint32_t> name_at;
+
+  // nul separated Execs of the handlers
+  std::string execs;
+  std::vector<std::string_view> exec_list;
+
+  // CLOCK_REALTIME ns the index read back was taken at
+  uint64_t built = 0;
+
+  pool_t pool;
+  std::atomic<size_t> next_chunk;
+
+  inline size_t size(void) const noexcept
+  {
+    return paths.size();
+  }
+
+  void build(const std::vector<std::string_view> &items,
+             std::vector<uint16_t> &&item_handlers,
+             const std::vector<std::string> &handler_execs)
+  {
+    paths.build(items);
+    handlers = std::move(item_handlers);
+    split_names();
+
+    execs.clear();
+    for (const auto &exec: handler_execs) {
+      execs += exec;
+      execs += '\0';
+    }
+    split_execs();
+  }
+
+  void split_names(void)
+  {
+    names.clear();
+    name_at.clear();
+    name_at.reserve(size() + 1);
+
+    std::string buf;
+    paths.for_each(buf, [&](uint32_t, std::string_view path, size_t) {
+      name_at.emplace_back(names.size());
+      for (const auto c: path.substr(path.rfind('/') + 1)) names += tolower((uint8_t) c);
+      names += '\0';
+    });
+    name_at.emplace_back(names.size());
+    names.shrink_to_fit();
+  }
+
+  void split_execs(void)
+  {
+    exec_list.clear();
+    for (size_t at = 0; at < execs.size();) {
+      const auto end = execs.find('\0', at);
+      exec_list.emplace_back(execs.data() + at, end - at);
+      at = end + 1;
+    }
+  }
+
+  // starts the threads searching the index in parallel, by default one
+  // per core for a large index and none for a small one
+  void start_pool(size_t threads = 0)
+  {
+    if (threads == 0) {
+      threads = size() >= FILES_PARALLEL_MIN ? std::max(1u, std::thread::hardware_concurrency()) : 1;
+    }
+    pool.start(threads);
+  }
+
+  // calls f(worker, index, at, name_len) for every path whose name
+  // contains prompt (lowercase), at being where. the workers each take the
+  // names of FILES_CHUNK paths at a time. the name a hit is in is searched
+  // for galloping from the one before, short prompts hit names close by.
+  template <typename F>
+  void find(const std::string_view &prompt, const F &f)
+  {
+    next_chunk = 0;
+
+    const auto work = [&](size_t worker) {
+      while (true) {
+        const auto start = next_chunk.fetch_add(FILES_CHUNK, std::memory_order_relaxed);
+        if (start >= size()) return;
+
+        const auto end = std::min(size(), start + FILES_CHUNK);
+        const char *chunk_end = names.data() + name_at[end];
+
+        for (size_t i = start; i < end;) {
+          const char *p = names.data() + name_at[i];
+          const char *hit = (const char *) memmem(p, chunk_end - p, prompt.data(), prompt.size());
+          if (!hit) break;
+
+          const uint32_t at = hit - names.data();
+          size_t hi = i + 1;
+          for (size_t step = 1; hi < end && name_at[hi] <= at; step *= 2) {
+            i = hi;
+            hi = std::min(end, hi + step);
+          }
+          i = std::upper_bound(name_at.begin() + i, name_at.begin() + hi, at) - name_at.begin() - 1;
+
+          f(worker, paths.order[i], at - name_at[i], name_at[i + 1] - name_at[i] - 1);
+          i++;
+        }
+      }
+    };
+
+    if (pool.started()) {
+      pool.run(work);
+    } else {
+      work(0);
+    }
+  }
+
+  inline std::string_view path(size_t index, std::string &buf) const
+  {
+    return paths.get(index, buf);
+  }
+
+  inline std::string_view exec(size_t index) const noexcept
+  {
+    return handlers[index] < exec_list.size() ? exec_list[handlers[index]] : FILES_FALLBACK_EXEC;
+  }
+
+  bool read(const std::string &path, uint64_t config_hash)
+  {
+    auto ok = true;
+    const auto file = file_t::read(path.c_str(), &ok);
+    if (file.size < sizeof(files_index_header_t)) return false;
+
+    files_index_header_t h;
+    memcpy(&h, file.sv.data(), sizeof(h));
+    if (h.magic != FILES_INDEX_MAGIC || h.version != FILES_INDEX_VERSION || h.config_hash != config_hash) {
+      return false;
+    }
+
+    const size_t blocks_len = (h.paths_len + front_coded_t::BLOCK - 1) / front_coded_t::BLOCK;
+    const size_t size = sizeof(h) + h.bytes_size + h.execs_size
+      + (blocks_len + h.paths_len) * sizeof(uint32_t) + h.paths_len * sizeof(uint16_t);
+    if (file.size != size) return false;
+
+    const char *p = file.sv.data() + sizeof(h);
+    const auto take = [&](auto &v, size_t n) {
+      v.resize(n);
+      memcpy(v.data(), p, n * sizeof(v[0]));
+      p += n * sizeof(v[0]);
+    };
+
+    take(paths.blocks, blocks_len);
+    take(paths.order, h.paths_len);
+    take(handlers, h.paths_len);
+    take(paths.bytes, h.bytes_size);
+    take(execs, h.execs_size);
+
+    if (!paths.restore() || (!execs.empty() && execs.back() != '\0')) {
+      paths.clear();
+      return false;
+    }
+
+    split_names();
+    split_execs();
+    built = h.built;
+    return true;
+  }
+
+  // an index read back misses entries added to or removed from the root
+  // or a dir right below it since, those dirs' mtimes tell. changes deeper
+  // down only show once it is FILES_INDEX_MAX_AGE_NS old.
+  bool stale(const files_config_t &config) const
+  {
+    if (realtime_ns() - built > FILES_INDEX_MAX_AGE_NS) return true;
+
+    const auto mtime = [](const struct stat &st) {
+      return (uint64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    };
+
+    DIR *dir = opendir(config.root.c_str());
+    if (!dir) return false;
+
+    struct stat st;
+    auto ret = fstat(dirfd(dir), &st) == 0 && mtime(st) > built;
+    while (const auto *e = ret ? NULL : readdir(dir)) {
+      if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0 || config.skipped(e->d_name)) continue;
+      if (e->d_type != DT_DIR && e->d_type != DT_UNKNOWN) continue;
+      if (fstatat(dirfd(dir), e->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode)) {
+        ret = mtime(st) > built;
+      }
+    }
+
+    closedir(dir);
+    return ret;
+  }
+
+  // takes the index other holds, other gets this one's. the pools stay.
+  void swap(file_index_t &other) noexcept
+  {
+    std::swap(paths, other.paths);
+    std::swap(handlers, other.handlers);
+    std::swap(names, other.names);
+    std::swap(name_at, other.name_at);
+    std::swap(execs, other.execs);
+    std::swap(built, other.built);
+
+    // short execs move inline with the string, the views are taken again
+    split_execs();
+    other.split_execs();
+  }
+
+  // written next to path and renamed over it, like the system index
+  bool write(const std::string &path, uint64_t config_hash, uint64_t built) const
+  {
+    const auto slash = path.rfind('/');
+    if (slash != std::string::npos && slash > 0) mkdir(path.substr(0, slash).c_str(), 0755);
+
+    const auto tmp = path + ".tmp." + std::to_string(getpid());
+    const int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd == -1) {
+      eprintf("could not create %s: %s\n", tmp.c_str(), strerror(errno));
+      return false;
+    }
+
+    const files_index_header_t header = {
+      .magic = FILES_INDEX_MAGIC,
+      .version = FILES_INDEX_VERSION,
+      .config_hash = config_hash,
+      .built = built,
+      .paths_len = (uint32_t) size(),
+      .bytes_size = (uint32_t) paths.bytes.size(),
+      .execs_size = (uint32_t) execs.size(),
+    };
+
+    const auto put = [&](const void *data, size_t n) {
+      return ::write(fd, data, n) == (ssize_t) n;
+    };
+
+    const auto ok = put(&header, sizeof(header))
+      && put(paths.blocks.data(), paths.blocks.size() * sizeof(uint32_t))
+      && put(paths.order.data(), paths.order.size() * sizeof(uint32_t))
+      && put(handlers.data(), handlers.size() * sizeof(uint16_t))
+      && put(paths.bytes.data(), paths.bytes.size())
+      && put(execs.data(), execs.size())
+      && fsync(fd) == 0;
+
+    close(fd);
+
+    if (!ok || rename(tmp.c_str(), path.c_str()) == -1) {
+      eprintf("could not write %s: %s\n", path.c_str(), strerror(errno));
+      unlink(tmp.c_str());
+      return false;
+    }
+
+    return true;
+  }
+
+  // crawls config.root, watching every dir it enters on inotify_fd unless
+  // that is -1. false, with nothing built, when cancel was set before it
+  // was done.
+  bool crawl(const files_config_t &config, int inotify_fd, const std::atomic<bool> *cancel = NULL)
+  {
+    mime_handlers_t mime;
+    mime.load();
+
+    crawl_t crawl(config, inotify_fd, cancel);
+    crawl.run();
+    if (crawl.cancelled()) return false;
+
+    size_t n = 0;
+    for (const auto &crawled: crawl.out) n += crawled.paths.size();
+
+    std::vector<std::string_view> items;
+    std::vector<uint16_t> item_handlers;
+    items.reserve(n);
+    item_handlers.reserve(n);
+
+    for (const auto &crawled: crawl.out) {
+      for (size_t i = 0; i < crawled.paths.size(); ++i) {
+        items.emplace_back(crawled.paths[i]);
+        item_handlers.emplace_back(mime.handler(crawled.paths[i], crawled.dirs[i]));
+      }
+    }
+
+    build(items, std::move(item_handlers), mime.execs);
+    return true;
+  }
+};
+
+static file_index_t file_index;
+
+// Exec with the path passed for its first file or url field code, quoted
+// the way the desktop entry spec has it, or after it if it has none
+static inline void exec_with_file(const std::string_view &exec, const std::string_view &path, std::string &out)
+{
+  std::string quoted = "\"";
+  for (const auto c: path) {
+    if (c == '"' || c == '`' || c == '$' || c == '\\') quoted += '\\';
+    if (c == '%') quoted += '%';
+    quoted += c;
+  }
+  quoted += '"';
+
+  out.clear();
+  bool passed = false;
+  for (size_t i = 0; i < exec.size(); ++i) {
+    if (exec[i] == '%' && i + 1 < exec.size()) {
+      const auto code = exec[++i];
+      if (!passed && strchr("fFuU", code)) {
+        out += quoted;
+        passed = true;
+      } else {
+        out += '%';
+        out += code;
+      }
+      continue;
+    }
+    out += exec[i];
+  }
+
+  if (!passed) {
+    out += ' ';
+    out += quoted;
+  }
+}
+
+// `rapp --files-daemon`: crawls, writes the index and crawls again
+// FILES_DEBOUNCE_MS after the last of a burst of changes below the root
+static inline int run_files_daemon(void)
+{
+  const auto config = files_config();
+  const auto path = files_index_path();
+
+  const int fd = inotify_init1(IN_CLOEXEC);
+  if (fd == -1) {
+    eprintf("could not initialize inotify: %s\n", strerror(errno));
+    return 1;
+  }
+
+  alignas(struct inotify_event) char buf[64 * 1024];
+  struct pollfd pfd = {.fd = fd, .events = POLLIN, .revents = 0};
+
+  while (true) {
+    const auto built = realtime_ns();
+    file_index_t index;
+    index.crawl(config, fd);
+    index.write(path, config.hash(), built);
+
+    // block until something changes, then until nothing did for a while
+    int timeout = FILES_REFRESH_MS;
+    while (true) {
+      const int ready = poll(&pfd, 1, timeout);
+      if (ready == -1 && errno == EINTR) continue;
+      if (ready <= 0) break;
+
+      if (read(fd, buf, sizeof(buf)) == -1 && errno != EAGAIN && errno != EINTR) {
+        eprintf("could not read inotify events: %s\n", strerror(errno));
+        close(fd);
+        return 1;
+      }
+      timeout = FILES_DEBOUNCE_MS;
+    }
+  }
+}
@@ -0,0 +1,213 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <string_view>
+
+// a read only list of strings front coded: sorted, cut into blocks of
+// BLOCK strings, the first of every block stored whole and every other one
+// as the length of the prefix it shares with the one before it plus the
+// rest. large lists of paths share most of their bytes with their sorted
+// neighbours, so they take a fraction of the arena they would intern into.
+// strings are decoded one block at a time into a buffer the caller owns and
+// keep the index they were added with.
+
+struct front_coded_t {
+  static constexpr size_t BLOCK = 16;
+
+  // per string: varint shared length, varint suffix length, suffix
+  std::string bytes;
+  std::vector<uint32_t> blocks;
+
+  // sorted position -> index the string was added with, and back
+  std::vector<uint32_t> order, position;
+
+  inline size_t size(void) const noexcept
+  {
+    return order.size();
+  }
+
+  inline size_t memory(void) const noexcept
+  {
+    return bytes.capacity() + (blocks.capacity() + order.capacity() + position.capacity()) * sizeof(uint32_t);
+  }
+
+  void clear(void)
+  {
+    bytes = {};
+    blocks = {};
+    order = {};
+    position = {};
+  }
+
+  void build(const std::vector<std::string_view> &strings)
+  {
+    clear();
+
+    order.resize(strings.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+      return strings[a] != strings[b] ? strings[a] < strings[b] : a < b;
+    });
+
+    position.resize(strings.size());
+    blocks.reserve((strings.size() + BLOCK - 1) / BLOCK);
+
+    std::string_view prev;
+    for (size_t i = 0; i < order.size(); ++i) {
+      const auto s = strings[order[i]];
+      position[order[i]] = i;
+
+      size_t shared = 0;
+      if (i % BLOCK == 0) {
+        blocks.push_back(bytes.size());
+      } else {
+        const auto n = std::min(prev.size(), s.size());
+        while (shared < n && prev[shared] == s[shared]) shared++;
+      }
+
+      put_varint(shared);
+      put_varint(s.size() - shared);
+      bytes.append(s.substr(shared));
+      prev = s;
+    }
+
+    bytes.shrink_to_fit();
+  }
+
+  // calls f(index, string, shared) for every string of block b in sorted
+  // order, shared being how many bytes it begins with are still those of
+  // the string before (0 for the first). string points into buf and is only
+  // valid until the next call.
+  template <typename F>
+  inline void decode_block(size_t b, std::string &buf, F f) const
+  {
+    const char *p = bytes.data() + blocks[b];
+    const size_t end = std::min(size(), (b + 1) * BLOCK);
+
+    for (size_t i = b * BLOCK; i < end; ++i) {
+      const auto shared = next(p, buf);
+      f(order[i], std::string_view(buf), shared);
+    }
+  }
+
+  template <typename F>
+  void for_each(std::string &buf, F f) const
+  {
+    for (size_t b = 0; b < blocks.size(); ++b) decode_block(b, buf, f);
+  }
+
+  // calls f(index, string, at) for every string containing needle in sorted
+  // order, at being the first occurrence like std::string_view::find. an
+  // occurrence inside the shared prefix was found in the string before, so
+  // only the bytes past it (and needle.size() - 1 before, for one straddling
+  // it) are searched.
+  template <typename F>
+  void find(const std::string_view &needle, std::string &buf, F f) const
+  {
+    const auto m = needle.size();
+
+    for (size_t b = 0; b < blocks.size(); ++b) {
+      const char *p = bytes.data() + blocks[b];
+      const size_t end = std::min(size(), (b + 1) * BLOCK);
+
+      size_t at = std::string_view::npos;
+      for (size_t i = b * BLOCK; i < end; ++i) {
+        const auto shared = next(p, buf);
+        const std::string_view s = buf;
+        if (at == std::string_view::npos || at + m > shared) {
+          at = s.find(needle, m && shared >= m ? shared - m + 1 : 0);
+        }
+
+        if (at != std::string_view::npos) f(order[i], s, at);
+      }
+    }
+  }
+
+  // the string added as index, decoding its block up to it
+  std::string_view get(size_t index, std::string &buf) const
+  {
+    const size_t i = position[index];
+    const char *p = bytes.data() + blocks[i / BLOCK];
+    for (size_t j = i / BLOCK * BLOCK; j <= i; ++j) next(p, buf);
+    return buf;
+  }
+
+  // rebuilds position after bytes, blocks and order were read back from
+  // somewhere, false when they do not decode within bytes
+  bool restore(void)
+  {
+    if (blocks.size() != (size() + BLOCK - 1) / BLOCK) return false;
+
+    position.assign(size(), UINT32_MAX);
+    for (size_t i = 0; i < size(); ++i) {
+      if (order[i] >= size() || position[order[i]] != UINT32_MAX) return false;
+      position[order[i]] = i;
+    }
+
+    // every varint and suffix must end inside bytes, shared can not reach
+    // past the string before
+    size_t prev = 0;
+    for (size_t b = 0; b < blocks.size(); ++b) {
+      if (blocks[b] >= bytes.size()) return false;
+
+      const char *p = bytes.data() + blocks[b];
+      const char *end = bytes.data() + bytes.size();
+      for (size_t i = b * BLOCK; i < std::min(size(), (b + 1) * BLOCK); ++i) {
+        size_t shared, suffix;
+        if (!get_varint(p, end, shared) || !get_varint(p, end, suffix)) return false;
+        if (shared > (i % BLOCK ? prev : 0) || suffix > (size_t) (end - p)) return false;
+        p += suffix;
+        prev = shared + suffix;
+      }
+    }
+
+    return true;
+  }
+
+private:
+  // decodes the string at p over the one before it in buf
+  static inline size_t next(const char *&p, std::string &buf)
+  {
+    const auto shared = get_varint(p);
+    const auto suffix = get_varint(p);
+    buf.resize(shared);
+    buf.append(p, suffix);
+    p += suffix;
+    return shared;
+  }
+
+  inline void put_varint(size_t n)
+  {
+    while (n >= 0x80) {
+      bytes.push_back((char) (n | 0x80));
+      n >>= 7;
+    }
+    bytes.push_back((char) n);
+  }
+
+  static inline size_t get_varint(const char *&p) noexcept
+  {
+    size_t n = 0;
+    for (unsigned shift = 0;; shift += 7) {
+      const auto c = (uint8_t) *p++;
+      n |= (size_t) (c & 0x7F) << shift;
+      if (!(c & 0x80)) return n;
+    }
+  }
+
+  static inline bool get_varint(const char *&p, const char *end, size_t &n) noexcept
+  {
+    n = 0;
+    for (unsigned shift = 0; p < end && shift < 64; shift += 7) {
+      const auto c = (uint8_t) *p++;
+      n |= (size_t) (c & 0x7F) << shift;
+      if (!(c & 0x80)) return true;
+    }
+    return false;
+  }
+};
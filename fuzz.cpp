@@ -0,0 +1,488 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <string_view>
+
+// the queries are checked not to allocate through the metrics.h hook
+#define RAPP_COUNT_ALLOCS
+
+#include "corpus.h"
+#include "search.h"
+#include "providers.h"
+#include "completion.h"
+
+// differential test of the search engines: random corpora and typing
+// sequences go through a deliberately naive reference of the search()
+// semantics and through every engine in ENGINES, the results must match.
+// built with -DRAPP_LIBFUZZER (clang, -fsanitize=fuzzer) the same check is
+// a libFuzzer entry point instead.
+//
+// the results must be equal element by element, except that without a
+// history the order of the fuzzy matches after the initials and substring
+// matches is up to the engine, there they are compared as sets. no query
+// may allocate either, nor may completing the prompt, filter_apps() runs
+// both on every keystroke. the files provider is checked the same way against
+// a plain scan, on one thread and on several.
+
+constexpr int MAX_DIST = 4;
+
+constexpr size_t FUZZ_APPS_CAP = 512;
+constexpr size_t FUZZ_NAME_CAP = 64;
+
+struct engine_t {
+  const char *name;
+  void (*build)(void);
+  void (*query)(const std::string &prompt, std::vector<size_t> &out);
+};
+
+// chunks of a few apps, so that even the small corpora are split over
+// every thread of the pool
+static void build_parallel_fuzz_index(void)
+{
+  build_parallel_index(4, 7);
+}
+
+static const engine_t ENGINES[] = {
+  {"search",   build_index,               search},
+  {"parallel", build_parallel_fuzz_index, search},
+};
+
+static int levenshtein(std::string_view a, std::string_view b)
+{
+  std::vector<std::vector<int>> d(a.size() + 1, std::vector<int>(b.size() + 1));
+
+  for (size_t i = 0; i <= a.size(); ++i) d[i][0] = i;
+  for (size_t j = 0; j <= b.size(); ++j) d[0][j] = j;
+
+  for (size_t i = 1; i <= a.size(); ++i) {
+    for (size_t j = 1; j <= b.size(); ++j) {
+      d[i][j] = std::min({
+        d[i - 1][j] + 1,
+        d[i][j - 1] + 1,
+        d[i - 1][j - 1] + (a[i - 1] != b[j - 1]),
+      });
+    }
+  }
+
+  return d[a.size()][b.size()];
+}
+
+static bool is_word_char(char c)
+{
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || (uint8_t) c >= 0x80;
+}
+
+static bool is_digit(char c)
+{
+  return c >= '0' && c <= '9';
+}
+
+static bool is_upper(char c)
+{
+  return c >= 'A' && c <= 'Z';
+}
+
+static bool is_lower(char c)
+{
+  return c >= 'a' && c <= 'z';
+}
+
+// words start after a non word character, at camelCase humps and where
+// digits meet letters. the initials are lowercased, a multibyte character
+// starting a word goes in with its continuation bytes.
+static std::string initials(std::string_view name)
+{
+  std::string ret;
+  for (size_t i = 0; i < name.size(); ++i) {
+    if (!is_word_char(name[i])) continue;
+
+    const bool starts_word = i == 0
+      || !is_word_char(name[i - 1])
+      || (is_upper(name[i]) && is_lower(name[i - 1]))
+      || ((uint8_t) name[i] < 0x80 && (uint8_t) name[i - 1] < 0x80 && is_digit(name[i]) != is_digit(name[i - 1]));
+
+    if (!starts_word) continue;
+
+    ret += is_upper(name[i]) ? name[i] - 'A' + 'a' : name[i];
+    if ((uint8_t) name[i] < 0xC0) continue;
+    while (i + 1 < name.size() && ((uint8_t) name[i + 1] & 0xC0) == 0x80) ret += name[++i];
+  }
+  return ret;
+}
+
+// 2 for an initials match, 1 for a substring match, 0 otherwise
+static int match_class(const std::string &prompt, size_t i)
+{
+  if (prompt.size() >= 2 && initials(apps[i].name).compare(0, prompt.size(), prompt) == 0) return 2;
+  if (apps[i].name.find(prompt) != std::string::npos) return 1;
+  return 0;
+}
+
+// 1 edit for prompts of 4 to 7 characters, 2 up to 32, none otherwise
+static bool prefix_match(const std::string &prompt, std::string_view name)
+{
+  const int m = prompt.size();
+  if (m < 4 || m > 32) return false;
+
+  const int max_dist = m < 8 ? 1 : 2;
+  for (int len = std::max(0, m - max_dist); len <= std::min<int>(name.size(), m + max_dist); ++len) {
+    if (levenshtein(prompt, name.substr(0, len)) <= max_dist) return true;
+  }
+  return false;
+}
+
+// returns how many of the results are initials or substring matches
+static size_t reference(const std::string &prompt, std::vector<size_t> &out)
+{
+  out.clear();
+
+  for (size_t i = 0; i < apps.size(); ++i) {
+    if (match_class(prompt, i) == 2) out.emplace_back(i);
+  }
+
+  std::sort(out.begin(), out.end(), [&](const auto &a, const auto &b) {
+    const auto a_initials = initials(apps[a].name), b_initials = initials(apps[b].name);
+    return a_initials != b_initials ? a_initials < b_initials : a < b;
+  });
+
+  for (size_t i = 0; i < apps.size(); ++i) {
+    if (match_class(prompt, i) == 1) out.emplace_back(i);
+  }
+
+  const auto exact_matches = out.size();
+  for (size_t i = 0; i < apps.size(); ++i) {
+    if (match_class(prompt, i) == 0
+        && (prefix_match(prompt, apps[i].name) || levenshtein(prompt, apps[i].name) <= MAX_DIST))
+    {
+      out.emplace_back(i);
+    }
+  }
+
+  if (!ranks.empty()) {
+    std::sort(out.begin(), out.end(), [&](const auto &a, const auto &b) {
+      if (app_ranks[a] != app_ranks[b]) return app_ranks[a] > app_ranks[b];
+      if (match_class(prompt, a) != match_class(prompt, b)) return match_class(prompt, a) > match_class(prompt, b);
+      return a < b;
+    });
+  }
+
+  return exact_matches;
+}
+
+static bool same_results(const std::vector<size_t> &want,
+                         size_t exact_matches,
+                         const std::vector<size_t> &got)
+{
+  if (want.size() != got.size()) return false;
+  if (!ranks.empty()) return want == got;
+
+  if (!std::equal(want.begin(), want.begin() + exact_matches, got.begin())) {
+    return false;
+  }
+
+  auto want_fuzzy = std::vector(want.begin() + exact_matches, want.end());
+  auto got_fuzzy = std::vector(got.begin() + exact_matches, got.end());
+  std::sort(want_fuzzy.begin(), want_fuzzy.end());
+  std::sort(got_fuzzy.begin(), got_fuzzy.end());
+  return want_fuzzy == got_fuzzy;
+}
+
+static void print_results(const char *label, const std::vector<size_t> &results)
+{
+  eprintf("  %s (%zu):", label, results.size());
+  for (const auto i: results) eprintf(" %zu", i);
+  eprintf("\n");
+}
+
+static void print_mismatch(const engine_t &engine,
+                           const std::string &prompt,
+                           const std::vector<size_t> &want,
+                           const std::vector<size_t> &got)
+{
+  eprintf("engine `%s` disagrees with the reference on \"%s\"\n", engine.name, prompt.c_str());
+  eprintf("  corpus (%zu apps, %s):\n", apps.size(), ranks.empty() ? "no history" : "with history");
+  for (size_t i = 0; i < apps.size(); ++i) {
+    eprintf("    %zu: \"%s\" rank=%zu\n", i, apps[i].name.data(), app_ranks[i]);
+  }
+  print_results("want", want);
+  print_results("got", got);
+}
+
+// feeds the prompts in order through every engine, engines may keep state
+// between consecutive prompts just like they would while the user types.
+static bool check(const std::vector<std::string> &prompts)
+{
+  rank_apps();
+  completions.build();
+
+  std::vector<size_t> want, got;
+  want.reserve(apps.size());
+  got.reserve(apps.size());
+
+  for (const auto &engine: ENGINES) {
+    drop_index();
+    engine.build();
+
+    for (const auto &prompt: prompts) {
+      // filter_apps() never searches for an empty prompt
+      if (prompt.empty()) continue;
+
+      const auto exact_matches = reference(prompt, want);
+
+      // got holds every app already, nothing a query does may allocate,
+      // the pool's workers included
+      const auto allocs = metrics::allocs.load();
+      engine.query(prompt, got);
+      completions.complete(prompt);
+      if (metrics::allocs.load() != allocs) {
+        eprintf("engine `%s` allocated %lu times searching for \"%s\"\n",
+                engine.name,
+                metrics::allocs.load() - allocs,
+                prompt.c_str());
+        drop_index();
+        return false;
+      }
+
+      if (!same_results(want, exact_matches, got)) {
+        print_mismatch(engine, prompt, want, got);
+        drop_index();
+        return false;
+      }
+    }
+  }
+
+  drop_index();
+  return true;
+}
+
+#if defined(RAPP_LIBFUZZER)
+
+// input: a flags byte (bit 0: give every app a launch count), then newline
+// separated app names up to an empty line, then the prompts.
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+  if (size == 0) return 0;
+
+  const bool ranked = data[0] & 1;
+  std::string_view input((const char *) data + 1, size - 1);
+
+  ranks.clear();
+  apps.clear();
+  app_strings.clear();
+
+  std::vector<std::string> prompts;
+  bool reading_apps = true;
+  while (!input.empty()) {
+    const auto end = std::min(input.find('\n'), input.size());
+    const auto line = input.substr(0, std::min(end, FUZZ_NAME_CAP));
+    input.remove_prefix(std::min(end + 1, input.size()));
+
+    if (reading_apps && line.empty()) {
+      reading_apps = false;
+    } else if (reading_apps) {
+      if (apps.size() < FUZZ_APPS_CAP) apps.push_back(app_t{app_strings.intern(line), "true"});
+    } else {
+      prompts.emplace_back(line);
+    }
+  }
+
+  if (ranked) {
+    for (size_t i = 0; i < apps.size(); ++i) {
+      ranks[apps[i].name] = apps[i].name.size() % 3;
+    }
+  }
+
+  if (!check(prompts)) abort();
+
+  return 0;
+}
+
+#else
+
+constexpr uint64_t SEED = 0xd1ff;
+
+// names over a tiny alphabet collide and land within a few edits of each
+// other far more often than realistic ones.
+static std::string generate_dense_name(rng_t &rng)
+{
+  static const char ALPHABET[] = "abcab -2";
+
+  std::string name;
+  const size_t len = rng.below(10);
+  for (size_t i = 0; i < len; ++i) {
+    name += ALPHABET[rng.below(sizeof(ALPHABET) - 1)];
+  }
+  return name;
+}
+
+static void generate_fuzz_corpus(rng_t &rng)
+{
+  const bool dense = rng.chance(0.5);
+  const size_t n = 1 + rng.below(dense ? 64 : FUZZ_APPS_CAP);
+
+  ranks.clear();
+  apps.clear();
+  app_strings.clear();
+
+  for (size_t i = 0; i < n; ++i) {
+    auto name = dense ? generate_dense_name(rng) : generate_name(rng);
+
+    // as written in some desktop files, with camelCase humps
+    if (!name.empty() && rng.chance(0.2)) {
+      auto &c = name[rng.below(name.size())];
+      if (is_lower(c)) c += 'A' - 'a';
+    }
+
+    apps.push_back(app_t{app_strings.intern(name), "true"});
+  }
+
+  if (rng.chance(0.5)) {
+    for (size_t i = 0; i < n / 2 + 1; ++i) {
+      ranks[apps[rng.below(n)].name] += 1 + rng.below(3);
+    }
+  }
+}
+
+// types a target one character at a time with typos, backspaces and the
+// occasional cleared prompt in between.
+static std::vector<std::string> generate_typing(rng_t &rng)
+{
+  std::vector<std::string> prompts;
+  std::string prompt;
+
+  for (size_t targets = 1 + rng.below(4); targets--;) {
+    const auto r = rng.below(10);
+    const auto target = r < 6 ? std::string(apps[rng.below(apps.size())].name)
+                      : r < 8 ? initials(apps[rng.below(apps.size())].name)
+                      : generate_dense_name(rng);
+
+    for (const auto c: target) {
+      prompt += rng.chance(0.1) ? 'a' + rng.below(26) : c;
+      prompts.emplace_back(prompt);
+
+      if (rng.chance(0.1)) {
+        prompt.resize(prompt.size() - std::min(prompt.size(), 1 + rng.below(3)));
+        prompts.emplace_back(prompt);
+      }
+    }
+
+    if (rng.chance(0.5)) prompt.clear();
+  }
+
+  return prompts;
+}
+
+// a fresh install has no history file, loading the index must still size
+// everything ranked by launch count
+static bool check_no_history(void)
+{
+  generate_corpus(3, SEED);
+  ranks.clear();
+  app_ranks.clear();
+
+  parse_ranks("/nonexistent/rapp_history");
+  rank_order();
+  completions.build();
+
+  std::vector<size_t> identity(apps.size());
+  std::iota(identity.begin(), identity.end(), 0);
+
+  if (app_ranks.size() != apps.size() || ranked_apps != identity || !completions.complete("a").empty()) {
+    eprintf("loading the index without a history file: app_ranks=%zu ranked_apps=%zu apps=%zu\n",
+            app_ranks.size(), ranked_apps.size(), apps.size());
+    return false;
+  }
+
+  return true;
+}
+
+// the files provider, with the index searched on one thread and split
+// over several, against a plain scan of the lowercase names
+static bool check_files(void)
+{
+  constexpr size_t FILES = 80000;
+  const size_t THREADS[] = {1, 4};
+
+  const auto paths = generate_paths(FILES, SEED);
+  const std::vector<std::string_view> items(paths.begin(), paths.end());
+  file_index.build(items, std::vector<uint16_t>(items.size(), 0), {FILES_FALLBACK_EXEC});
+
+  rng_t rng = {SEED};
+  std::vector<app_t> got;
+  std::vector<scored_t> want;
+  for (const auto threads: THREADS) {
+    start_files_pool(threads);
+
+    for (size_t q = 0; q < 32; ++q) {
+      // a piece of some name, in the case it was typed
+      const auto &path = paths[rng.below(paths.size())];
+      const auto name = std::string_view(path).substr(path.rfind('/') + 1);
+      const auto at = rng.below(name.size() + 1);
+      auto prompt = std::string(name.substr(at, 1 + rng.below(4)));
+      if (prompt.empty()) prompt = "a";
+      if (rng.chance(0.3)) prompt[0] = toupper((uint8_t) prompt[0]);
+
+      std::string lower = prompt;
+      for (auto &c: lower) c = tolower((uint8_t) c);
+
+      want.clear();
+      for (size_t i = 0; i < paths.size(); ++i) {
+        std::string name = paths[i].substr(paths[i].rfind('/') + 1);
+        for (auto &c: name) c = tolower((uint8_t) c);
+        const auto hit = name.find(lower);
+        if (hit != std::string::npos) want.push_back({match_score(hit, name.size()), i});
+      }
+      const auto n = best_scored(want);
+
+      got.clear();
+      query_files({}, prompt, got);
+
+      bool same = got.size() == n;
+      for (size_t i = 0; same && i < n; ++i) same = got[i].name == paths[want[i].idx];
+      if (!same) {
+        eprintf("files provider on %zu threads disagrees with the reference on \"%s\": %zu results, want %zu\n",
+                file_index.pool.size(), prompt.c_str(), got.size(), n);
+        return false;
+      }
+    }
+  }
+
+  file_index.pool.stop();
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  const char *program = shift(argc, argv);
+  if (argc > 2) {
+    eprintf("usage: %s [iterations [seed]]\n", program);
+    return 1;
+  }
+
+  const size_t iterations = argc > 0 ? strtoul(shift(argc, argv), NULL, 10) : 1000;
+  const uint64_t seed = argc > 0 ? strtoull(shift(argc, argv), NULL, 0) : SEED;
+
+  if (!check_no_history() || !check_files()) return 1;
+
+  for (size_t i = 0; i < iterations; ++i) {
+    rng_t rng = {seed + i};
+    generate_fuzz_corpus(rng);
+    const auto prompts = generate_typing(rng);
+
+    if (!check(prompts)) {
+      eprintf("reproduce with: %s 1 %lu\n", program, seed + i);
+      return 1;
+    }
+  }
+
+  printf("%zu corpora, %zu engines: ok\n", iterations, std::size(ENGINES));
+  return 0;
+}
+
+#endif
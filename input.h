@@ -0,0 +1,233 @@
+#pragma once
+
+#include <stdio.h>
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <string>
+#include <iterator>
+#include <algorithm>
+#include <string_view>
+
+#include "raylib.h"
+
+// every frame reads raylib's input once into a fixed-size snapshot and the
+// rest of rapp only looks at the snapshot. $RAPP_RECORD=path appends the
+// snapshots to a file, $RAPP_REPLAY=path feeds them back frame by frame
+// with the times they were taken at instead of reading raylib, so a
+// recorded session replays to the same prompt, selection and scroll
+// position. text pasted from the clipboard follows the frame it landed on,
+// a replay never reads the clipboard.
+
+namespace input {
+
+// the keys handle_keys() looks at, one bit each in the snapshot. new keys go
+// at the end, so older recordings keep their bits
+constexpr int KEYS[] = {
+  KEY_BACKSPACE, KEY_ENTER, KEY_LEFT_ALT, KEY_LEFT_CONTROL, KEY_LEFT_SHIFT,
+  KEY_CAPS_LOCK, KEY_A, KEY_B, KEY_D, KEY_E, KEY_F, KEY_K, KEY_N, KEY_P, KEY_Y,
+  KEY_TAB,
+};
+
+static_assert(std::size(KEYS) <= 32);
+
+enum button_t : uint8_t {
+  LEFT_DOWN     = 1 << 0,
+  LEFT_PRESSED  = 1 << 1,
+  LEFT_RELEASED = 1 << 2,
+};
+
+constexpr size_t CHARS_CAP = 18;
+
+struct frame_t {
+  double time;
+  float wheel;
+  Vector2 mouse;
+  uint32_t keys_down, keys_pressed;
+  uint8_t buttons;
+  uint8_t chars_len;
+  char chars[CHARS_CAP];
+  uint16_t paste_len;  // bytes pasted on this frame, following it
+};
+
+static_assert(sizeof(frame_t) == 56);
+
+constexpr uint32_t MAGIC = 0x49505152; // "RQPI"
+
+struct header_t {
+  uint32_t magic, frame_size;
+};
+
+static frame_t frame;
+static size_t frame_chars_read;
+static uint64_t frames;
+
+// what was pasted on the current frame. a recorded frame is only written
+// once the next one is taken, the paste lands after its snapshot.
+static std::string pasted;
+static bool unwritten;
+
+static FILE *record, *replay;
+
+static inline bool open(void)
+{
+  if (const char *path = getenv("RAPP_REPLAY")) {
+    header_t header;
+    replay = fopen(path, "rb");
+    if (!replay
+        || fread(&header, sizeof(header), 1, replay) != 1
+        || header.magic != MAGIC
+        || header.frame_size != sizeof(frame_t))
+    {
+      fprintf(stderr, "could not open input recording: %s\n", path);
+      return false;
+    }
+  }
+
+  if (const char *path = getenv("RAPP_RECORD")) {
+    const header_t header = {MAGIC, sizeof(frame_t)};
+    record = fopen(path, "wb");
+    if (!record || fwrite(&header, sizeof(header), 1, record) != 1) {
+      fprintf(stderr, "could not open input recording: %s\n", path);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static inline void write_frame(void)
+{
+  if (!unwritten) return;
+  unwritten = false;
+
+  frame.paste_len = pasted.size();
+  fwrite(&frame, sizeof(frame), 1, record);
+  fwrite(pasted.data(), 1, pasted.size(), record);
+  pasted.clear();
+}
+
+static inline void close(void)
+{
+  if (record) {
+    write_frame();
+    fclose(record);
+  }
+  if (replay) fclose(replay);
+  record = replay = NULL;
+}
+
+static inline bool replaying(void)
+{
+  return replay != NULL;
+}
+
+static inline int key_bit(int key)
+{
+  for (size_t i = 0; i < std::size(KEYS); ++i) {
+    if (KEYS[i] == key) return i;
+  }
+
+  assert(false && "key is not in input::KEYS");
+  return 0;
+}
+
+static inline void snapshot(frame_t &f)
+{
+  f = {};
+  f.time = GetTime();
+  f.wheel = GetMouseWheelMove();
+  f.mouse = GetMousePosition();
+
+  for (size_t i = 0; i < std::size(KEYS); ++i) {
+    if (IsKeyDown(KEYS[i]))    f.keys_down    |= 1u << i;
+    if (IsKeyPressed(KEYS[i])) f.keys_pressed |= 1u << i;
+  }
+
+  if (IsMouseButtonDown(MOUSE_BUTTON_LEFT))     f.buttons |= LEFT_DOWN;
+  if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT))  f.buttons |= LEFT_PRESSED;
+  if (IsMouseButtonReleased(MOUSE_BUTTON_LEFT)) f.buttons |= LEFT_RELEASED;
+
+  // whatever does not fit stays queued in raylib for the next frame
+  while (f.chars_len < CHARS_CAP) {
+    const char c = GetCharPressed();
+    if (c <= 0) break;
+    f.chars[f.chars_len++] = c;
+  }
+}
+
+// takes the input of the next frame, false once a replay has run out
+static inline bool next(void)
+{
+  if (record) write_frame();
+
+  frame_chars_read = 0;
+
+  if (replay) {
+    if (fread(&frame, sizeof(frame), 1, replay) != 1) return false;
+    pasted.resize(frame.paste_len);
+    if (fread(pasted.data(), 1, pasted.size(), replay) != pasted.size()) return false;
+  } else {
+    snapshot(frame);
+  }
+
+  unwritten = true;
+  frames++;
+  return true;
+}
+
+static inline double time(void)
+{
+  return frame.time;
+}
+
+// text pasted from the clipboard on this frame, recorded along with it
+static inline void paste(const std::string_view &text)
+{
+  if (!record || replay) return;
+  pasted.append(text.substr(0, UINT16_MAX - std::min<size_t>(UINT16_MAX, pasted.size())));
+}
+
+// what the recording pasted on this frame
+static inline std::string_view replayed_paste(void)
+{
+  return replay ? std::string_view(pasted) : std::string_view();
+}
+
+static inline char char_pressed(void)
+{
+  return frame_chars_read < frame.chars_len ? frame.chars[frame_chars_read++] : 0;
+}
+
+static inline bool is_key_down(int key)
+{
+  return frame.keys_down & (1u << key_bit(key));
+}
+
+static inline bool is_key_pressed(int key)
+{
+  return frame.keys_pressed & (1u << key_bit(key));
+}
+
+static inline float mouse_wheel_move(void)
+{
+  return frame.wheel;
+}
+
+static inline Vector2 mouse_position(void)
+{
+  return frame.mouse;
+}
+
+static inline bool is_mouse_button_pressed(void)
+{
+  return frame.buttons & LEFT_PRESSED;
+}
+
+static inline bool is_mouse_button_released(void)
+{
+  return frame.buttons & LEFT_RELEASED;
+}
+
+}
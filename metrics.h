@@ -0,0 +1,544 @@
+#pragma once
+
+#include <time.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include <new>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+
+#include "trace.h"
+
+#if defined(RAPP_TRACE) && !defined(RAPP_COUNT_ALLOCS)
+#define RAPP_COUNT_ALLOCS
+#endif
+
+namespace metrics {
+
+static inline uint64_t now(void) noexcept
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// blocks the calling thread read from disk and its major page faults, both
+// stay put while everything it touches is in the page cache.
+static inline uint64_t disk_reads(void) noexcept
+{
+  struct rusage ru;
+  if (getrusage(RUSAGE_THREAD, &ru) == -1) return 0;
+  return ru.ru_inblock + ru.ru_majflt;
+}
+
+// log-linear histogram of nanosecond values, SUB buckets per power of two,
+// so every recorded value is off by at most 1/SUB of itself.
+struct histogram_t {
+  static constexpr int SUB_BITS = 5;
+  static constexpr int SUB = 1 << SUB_BITS;
+  static constexpr int BUCKETS = (64 - SUB_BITS + 1) * SUB;
+
+  uint64_t counts[BUCKETS];
+  uint64_t total, max;
+
+  static inline constexpr int
+  bucket(uint64_t v) noexcept
+  {
+    if (v < SUB) return v;
+    const int e = 63 - __builtin_clzll(v);
+    return (e - SUB_BITS + 1) * SUB + ((v >> (e - SUB_BITS)) & (SUB - 1));
+  }
+
+  static inline constexpr uint64_t
+  upper_bound(int b) noexcept
+  {
+    if (b < SUB) return b;
+    const int e = b / SUB + SUB_BITS - 1;
+    const uint64_t lo = (uint64_t) (SUB + b % SUB) << (e - SUB_BITS);
+    return lo + ((uint64_t) 1 << (e - SUB_BITS)) - 1;
+  }
+
+  inline void record(uint64_t v, uint64_t n = 1) noexcept
+  {
+    counts[bucket(v)] += n;
+    total += n;
+    if (v > max) max = v;
+  }
+
+  inline uint64_t percentile(double p) const noexcept
+  {
+    if (total == 0) return 0;
+
+    const uint64_t target = (uint64_t) (p * total + 0.5);
+    uint64_t seen = 0;
+    for (int b = 0; b < BUCKETS; ++b) {
+      seen += counts[b];
+      if (seen >= target && seen > 0) {
+        return std::min(upper_bound(b), max);
+      }
+    }
+
+    return max;
+  }
+};
+
+// per-frame counters for the hud, written only by the thread owning them
+// (allocs by any thread, relaxed) so reading them never takes a lock. the
+// allocation counters stay 0 unless built with RAPP_COUNT_ALLOCS.
+static std::atomic<uint64_t> allocs;
+[[maybe_unused]] static thread_local uint64_t thread_allocs;
+
+struct search_t {
+  uint64_t initials, substring, prefix, bktree, sort;
+  size_t scanned, visited, results;
+  size_t fuzzy;   // results only the fuzzy stages found
+  size_t bktree_results;  // of those, results only the BKTree found
+};
+
+static search_t search;
+
+constexpr size_t FRAMES_CAP = 128;
+
+struct frames_t {
+  uint64_t work[FRAMES_CAP], period[FRAMES_CAP];
+  size_t len;
+
+  uint64_t start, submit, last_present, cpu_start;
+  uint64_t allocs_at_start, allocs;
+  size_t draws, last_draws;
+};
+
+static frames_t frames;
+
+struct stage_t {
+  uint64_t &slot;
+  uint64_t start;
+
+  inline stage_t(uint64_t &slot) noexcept
+    : slot(slot), start(now()) {}
+
+  inline ~stage_t(void) noexcept
+  {
+    slot = now() - start;
+  }
+};
+
+static inline uint64_t thread_cpu_now(void) noexcept
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// whole-session distributions of the main thread's cpu time per frame and
+// of the time between presented frames
+static histogram_t frame_cpu, frame_period;
+
+static inline void frame_begin(void) noexcept
+{
+  frames.start = now();
+  frames.cpu_start = thread_cpu_now();
+  frames.allocs_at_start = allocs.load(std::memory_order_relaxed);
+  frames.draws = 0;
+}
+
+static inline void frame_submit(void) noexcept
+{
+  frames.submit = now();
+}
+
+static inline void frame_end(uint64_t present) noexcept
+{
+  const auto i = frames.len++ % FRAMES_CAP;
+  frames.work[i] = frames.submit - frames.start;
+  frames.period[i] = frames.last_present ? present - frames.last_present : 0;
+  frames.last_present = present;
+
+  frame_cpu.record(thread_cpu_now() - frames.cpu_start);
+  if (frames.period[i]) frame_period.record(frames.period[i]);
+
+  frames.allocs = allocs.load(std::memory_order_relaxed) - frames.allocs_at_start;
+  frames.last_draws = frames.draws;
+}
+
+// keystroke-to-pixels: inputs are stamped when handle_keys() reads them and
+// the sample is taken once EndDrawing() of the frame that reflects them
+// returns, so it includes the search, drawing, swap and frame pacing.
+static histogram_t key_latency, search_latency;
+static uint64_t pending_input_ts, pending_inputs;
+
+static inline void input(void) noexcept
+{
+  if (pending_inputs++ == 0) {
+    pending_input_ts = now();
+  }
+}
+
+static inline void presented(void) noexcept
+{
+  const auto present = now();
+  frame_end(present);
+
+  if (pending_inputs == 0) return;
+
+  key_latency.record(present - pending_input_ts, pending_inputs);
+  pending_inputs = 0;
+}
+
+// $RAPP_LATENCY=- prints the summaries to stderr, any other value is a file
+// the summary lines are appended to.
+static inline void report(void)
+{
+  const char *path = getenv("RAPP_LATENCY");
+  if (!path || key_latency.total == 0) return;
+
+  FILE *f = strcmp(path, "-") == 0 ? stderr : fopen(path, "a");
+  if (!f) {
+    fprintf(stderr, "could not open latency file: %s\n", path);
+    return;
+  }
+
+  const auto ms = [](uint64_t ns) { return ns / 1e6; };
+
+  for (const auto &[name, h]: {
+    std::pair{"keystroke-to-frame", &key_latency},
+    std::pair{"frame-cpu", &frame_cpu},
+    std::pair{"frame-period", &frame_period},
+  }) {
+    fprintf(f,
+            "%ld %s: n=%lu p50=%.3fms p95=%.3fms p99=%.3fms max=%.3fms\n",
+            (long) time(NULL),
+            name,
+            h->total,
+            ms(h->percentile(0.50)),
+            ms(h->percentile(0.95)),
+            ms(h->percentile(0.99)),
+            ms(h->max));
+  }
+
+  if (f != stderr) fclose(f);
+}
+
+// one fixed-size record per session appended to the sessions file, read
+// back by `rapp --stats`. the magic versions what the fields count:
+// fuzzy_searches counts BKTree results, except in SESSION_MAGIC_V2 records
+// where it counted the fuzzy prefix stage's too. prefix_searches is only
+// recorded since SESSION_MAGIC, and so is index_cache.
+constexpr uint32_t SESSION_MAGIC_V1 = 0x53504152; // "RAPS"
+constexpr uint32_t SESSION_MAGIC_V2 = 0x32504152; // "RAP2"
+constexpr uint32_t SESSION_MAGIC = 0x33504152;    // "RAP3"
+
+enum index_load_t : uint8_t {
+  INDEX_PARSED,
+  INDEX_MAPPED,
+};
+
+// whether loading the index and the history had to read from disk
+enum index_cache_t : uint8_t {
+  INDEX_WARM,
+  INDEX_COLD,
+};
+
+struct session_t {
+  uint32_t magic, size;
+  int64_t started;
+  char build[24];
+  index_load_t index_load;
+  index_cache_t index_cache;
+  uint16_t prefix_searches;  // searches the fuzzy prefix stage added results to
+  uint32_t apps, keystrokes, searches;
+  int32_t rank;  // list position of the launched app, -1 if none
+  uint16_t fuzzy_searches;  // searches the BKTree added results to
+  uint16_t completions;     // ghost text completions accepted
+  uint64_t first_frame;  // ns from main() to the first presented frame
+  uint64_t key_p50, key_p95, key_p99;
+  uint64_t search_p50, search_p95, search_p99;
+  uint64_t launch;
+};
+
+static_assert(sizeof(session_t) == 128);
+
+static inline void count_session(uint16_t &counter)
+{
+  if (counter < UINT16_MAX) counter++;
+}
+
+static session_t session = {
+  .magic = SESSION_MAGIC,
+  .size = sizeof(session_t),
+  .build = __DATE__ " " __TIME__,
+  .rank = -1,
+};
+
+static inline void write_session(const char *path)
+{
+  session.started = time(NULL);
+  session.keystrokes = key_latency.total;
+  session.key_p50 = key_latency.percentile(0.50);
+  session.key_p95 = key_latency.percentile(0.95);
+  session.key_p99 = key_latency.percentile(0.99);
+  session.searches = search_latency.total;
+  session.search_p50 = search_latency.percentile(0.50);
+  session.search_p95 = search_latency.percentile(0.95);
+  session.search_p99 = search_latency.percentile(0.99);
+
+  const int fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+  if (fd == -1) return;
+
+  if (write(fd, &session, sizeof(session)) != sizeof(session)) {
+    fprintf(stderr, "could not write session metrics to: %s\n", path);
+  }
+
+  close(fd);
+}
+
+struct stat_t {
+  const char *name;
+  uint64_t session_t::*field;
+};
+
+static constexpr stat_t STATS[] = {
+  {"first frame", &session_t::first_frame},
+  {"key p50",     &session_t::key_p50},
+  {"key p95",     &session_t::key_p95},
+  {"key p99",     &session_t::key_p99},
+  {"search p50",  &session_t::search_p50},
+  {"search p95",  &session_t::search_p95},
+  {"search p99",  &session_t::search_p99},
+  {"launch",      &session_t::launch},
+};
+
+// a build is flagged when its median is this much worse than the previous one
+constexpr double REGRESSION_RATIO = 1.10;
+
+static inline uint64_t median(const session_t *sessions, size_t n, uint64_t session_t::*field)
+{
+  std::vector<uint64_t> values;
+  for (size_t i = 0; i < n; ++i) {
+    if (sessions[i].*field) values.emplace_back(sessions[i].*field);
+  }
+
+  if (values.empty()) return 0;
+
+  std::nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+  return values[values.size() / 2];
+}
+
+static inline int print_stats(const char *path, size_t last)
+{
+  const int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    fprintf(stderr, "no sessions recorded yet: %s\n", path);
+    return 1;
+  }
+
+  std::vector<session_t> sessions;
+  session_t s;
+  while (read(fd, &s, sizeof(s)) == sizeof(s)) {
+    if ((s.magic != SESSION_MAGIC && s.magic != SESSION_MAGIC_V2 && s.magic != SESSION_MAGIC_V1) || s.size != sizeof(s)) break;
+    sessions.emplace_back(s);
+  }
+
+  close(fd);
+
+  if (sessions.size() > last) {
+    sessions.erase(sessions.begin(), sessions.end() - last);
+  }
+
+  if (sessions.empty()) {
+    fprintf(stderr, "no sessions recorded yet: %s\n", path);
+    return 1;
+  }
+
+  const auto ms = [](uint64_t ns) { return ns / 1e6; };
+
+  // never fuzzy (the BKTree was never needed) only out of the sessions
+  // counting BKTree results alone, fuzzy prefix out of those recording it
+  size_t launched = 0, mapped = 0, counted_fuzzy = 0, no_fuzzy = 0, completed = 0;
+  size_t counted_prefix = 0, prefix = 0;
+  size_t keystrokes = 0, launch_keystrokes = 0, rank_sum = 0;
+  for (const auto &s: sessions) {
+    keystrokes += s.keystrokes;
+    mapped += s.index_load == INDEX_MAPPED;
+    if (s.magic != SESSION_MAGIC_V2) {
+      counted_fuzzy++;
+      no_fuzzy += s.fuzzy_searches == 0;
+    }
+    if (s.magic == SESSION_MAGIC) {
+      counted_prefix++;
+      prefix += s.prefix_searches > 0;
+    }
+    completed += s.completions > 0;
+    if (s.rank >= 0) {
+      launched++;
+      launch_keystrokes += s.keystrokes;
+      rank_sum += s.rank;
+    }
+  }
+
+  printf("sessions: %zu, launched: %zu, mapped index: %zu, never fuzzy: %zu/%zu, fuzzy prefix: %zu/%zu, "
+         "completed: %zu, keystrokes/session: %.1f, keystrokes/launch: %.1f, mean rank: %.2f\n",
+         sessions.size(),
+         launched,
+         mapped,
+         no_fuzzy,
+         counted_fuzzy,
+         prefix,
+         counted_prefix,
+         completed,
+         (double) keystrokes / sessions.size(),
+         launched ? (double) launch_keystrokes / launched : 0.0,
+         launched ? (double) rank_sum / launched : 0.0);
+
+  const auto print_percentiles = [&](const char *name, const histogram_t &h) {
+    printf("%-12s %8.3fms %8.3fms %8.3fms\n",
+           name,
+           ms(h.percentile(0.50)),
+           ms(h.percentile(0.95)),
+           ms(h.max));
+  };
+
+  printf("\n%-12s %10s %10s %10s\n", "", "p50", "p95", "max");
+  for (const auto &stat: STATS) {
+    histogram_t h = {};
+    for (const auto &s: sessions) {
+      if (s.*stat.field) h.record(s.*stat.field);
+    }
+    print_percentiles(stat.name, h);
+  }
+
+  // the first frame again, split by whether the index load hit the disk
+  histogram_t cold = {}, warm = {};
+  for (const auto &s: sessions) {
+    if (s.magic != SESSION_MAGIC || !s.first_frame) continue;
+    (s.index_cache == INDEX_COLD ? cold : warm).record(s.first_frame);
+  }
+  if (cold.total) print_percentiles("cold start", cold);
+  if (warm.total) print_percentiles("warm start", warm);
+
+  // medians per build, in the order the builds were first used
+  printf("\n%-24s %8s %11s", "build", "sessions", "keys/launch");
+  for (const auto &stat: STATS) printf(" %11s", stat.name);
+  printf("\n");
+
+  const session_t *prev = NULL;
+  size_t prev_n = 0;
+  for (size_t i = 0; i < sessions.size();) {
+    size_t j = i;
+    while (j < sessions.size() && strncmp(sessions[j].build, sessions[i].build, sizeof(s.build)) == 0) j++;
+
+    const auto group = sessions.data() + i;
+    const auto n = j - i;
+
+    size_t group_launched = 0, group_keystrokes = 0;
+    for (size_t k = 0; k < n; ++k) {
+      if (group[k].rank < 0) continue;
+      group_launched++;
+      group_keystrokes += group[k].keystrokes;
+    }
+
+    printf("%-24.24s %8zu %11.1f", group->build, n,
+           group_launched ? (double) group_keystrokes / group_launched : 0.0);
+    for (const auto &stat: STATS) printf(" %9.3fms", ms(median(group, n, stat.field)));
+    printf("\n");
+
+    if (prev) {
+      for (const auto &stat: STATS) {
+        const auto before = median(prev, prev_n, stat.field);
+        const auto after = median(group, n, stat.field);
+        if (before && after > before * REGRESSION_RATIO) {
+          printf("  regression: %s %.3fms -> %.3fms (+%.0f%%)\n",
+                 stat.name,
+                 ms(before),
+                 ms(after),
+                 (after / (double) before - 1) * 100);
+        }
+      }
+    }
+
+    prev = group;
+    prev_n = n;
+    i = j;
+  }
+
+  return 0;
+}
+
+}
+
+// counting allocator hook, compiled out unless built with -DRAPP_COUNT_ALLOCS
+// (implied by -DRAPP_TRACE): the including translation unit then replaces
+// the global operator new/delete for the whole binary. kept out of line, so
+// gcc does not pair the inlined free() against operator new and warn.
+#if defined(RAPP_COUNT_ALLOCS)
+
+[[gnu::noinline]] void *operator new(size_t n)
+{
+  metrics::allocs.fetch_add(1, std::memory_order_relaxed);
+  metrics::thread_allocs++;
+#if defined(RAPP_TRACE)
+  trace::count_alloc(n);
+#endif
+  if (void *p = malloc(n ? n : 1)) return p;
+  throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void *operator new[](size_t n)
+{
+  return operator new(n);
+}
+
+// the nothrow forms (std::stable_partition's buffer) must come from the
+// same malloc as the deletes below free into
+[[gnu::noinline]] void *operator new(size_t n, const std::nothrow_t &) noexcept
+{
+  try {
+    return operator new(n);
+  } catch (const std::bad_alloc &) {
+    return nullptr;
+  }
+}
+
+[[gnu::noinline]] void *operator new[](size_t n, const std::nothrow_t &) noexcept
+{
+  return operator new(n, std::nothrow);
+}
+
+[[gnu::noinline]] void operator delete(void *p) noexcept
+{
+  free(p);
+}
+
+[[gnu::noinline]] void operator delete[](void *p) noexcept
+{
+  free(p);
+}
+
+[[gnu::noinline]] void operator delete(void *p, size_t) noexcept
+{
+  free(p);
+}
+
+[[gnu::noinline]] void operator delete[](void *p, size_t) noexcept
+{
+  free(p);
+}
+
+[[gnu::noinline]] void operator delete(void *p, const std::nothrow_t &) noexcept
+{
+  free(p);
+}
+
+[[gnu::noinline]] void operator delete[](void *p, const std::nothrow_t &) noexcept
+{
+  free(p);
+}
+
+#endif
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <condition_variable>
+
+// threads started once and woken for every job instead of spawned per
+// keystroke. the thread calling run() works on the job as well, so a pool
+// of n threads starts n - 1 of them. workers are numbered from 1, the caller
+// is worker 0, and claim their share of the job themselves.
+
+struct pool_t {
+  std::vector<std::thread> threads;
+  std::mutex mutex;
+  std::condition_variable wake, done;
+
+  void (*job)(const void *ctx, size_t worker) = NULL;
+  const void *ctx = NULL;
+  uint64_t generation = 0;
+  size_t running = 0;
+  bool stopping = false;
+
+  ~pool_t(void)
+  {
+    stop();
+  }
+
+  inline bool started(void) const noexcept
+  {
+    return !threads.empty();
+  }
+
+  inline size_t size(void) const noexcept
+  {
+    return threads.size() + 1;
+  }
+
+  void start(size_t n)
+  {
+    stop();
+
+    threads.reserve(std::max<size_t>(n, 1) - 1);
+    for (size_t i = 1; i < n; ++i) {
+      threads.emplace_back(&pool_t::work, this, i, generation);
+    }
+  }
+
+  void stop(void)
+  {
+    if (!started()) return;
+
+    {
+      std::lock_guard lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+
+    for (auto &thread: threads) thread.join();
+    threads.clear();
+    stopping = false;
+  }
+
+  void work(size_t worker, uint64_t seen)
+  {
+    std::unique_lock lock(mutex);
+    while (true) {
+      wake.wait(lock, [&] { return stopping || generation != seen; });
+      if (stopping) return;
+      seen = generation;
+
+      lock.unlock();
+      job(ctx, worker);
+      lock.lock();
+
+      if (--running == 0) done.notify_one();
+    }
+  }
+
+  // returns once every worker is done with f(worker)
+  template <typename F>
+  void run(const F &f)
+  {
+    {
+      std::lock_guard lock(mutex);
+      job = [](const void *ctx, size_t worker) { (*(const F *) ctx)(worker); };
+      ctx = &f;
+      running = threads.size();
+      generation++;
+    }
+    wake.notify_all();
+
+    f(0);
+
+    std::unique_lock lock(mutex);
+    done.wait(lock, [&] { return running == 0; });
+  }
+};
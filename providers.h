@@ -0,0 +1,383 @@
+#pragma once
+
+#include <assert.h>
+#include <dirent.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <string_view>
+#include <unordered_set>
+#include <condition_variable>
+
+#include "apps.h"
+#include "files.h"
+#include "metrics.h"
+
+// sources of results besides the desktop entries, enabled by name through
+// $RAPP_PROVIDERS (comma separated). every provider loads its candidates
+// and answers queries on its own thread into buffers only it writes, so a
+// slow one never holds up the desktop entries the main thread searches
+// itself. the main thread posts every prompt to all of them and appends the
+// answers for the current prompt as they arrive, on the frame the prompt
+// changed it waits up to PROVIDER_DEADLINE_NS for them.
+
+constexpr size_t PROVIDER_RESULTS_CAP = 256;
+constexpr uint64_t PROVIDER_DEADLINE_NS = 2000000;
+
+// set under providers_mutex, also read without it by loads that take long
+static std::atomic<bool> providers_stopping;
+
+struct provider_t {
+  const char *name;
+
+  // fills candidates once, on the provider's thread before its first query
+  void (*load)(std::vector<app_t> &candidates, strings_t &strings);
+
+  // the best matches of prompt first, at most PROVIDER_RESULTS_CAP. their
+  // strings must stay valid until the query after the next one.
+  void (*query)(const std::vector<app_t> &candidates, const std::string &prompt, std::vector<app_t> &out);
+
+  // if set, called once the provider's thread is joined
+  void (*stop)(void);
+};
+
+// executables in $PATH, the first dir that has a name wins like in execvp
+static void load_path(std::vector<app_t> &candidates, strings_t &strings)
+{
+  const char *path = getenv("PATH");
+  if (!path) return;
+
+  std::unordered_set<std::string_view> names;
+  std::string file;
+
+  std::string_view dirs = path;
+  while (!dirs.empty()) {
+    const auto end = std::min(dirs.find(':'), dirs.size());
+    const auto dir = std::string(dirs.substr(0, end));
+    dirs.remove_prefix(std::min(end + 1, dirs.size()));
+
+    DIR *d = opendir(dir.empty() ? "." : dir.c_str());
+    if (!d) continue;
+
+    while (const auto *e = readdir(d)) {
+      if (e->d_name[0] == '.') continue;
+      if (e->d_type != DT_REG && e->d_type != DT_LNK && e->d_type != DT_UNKNOWN) continue;
+      if (names.count(e->d_name)) continue;
+
+      file = dir + "/" + e->d_name;
+      if (access(file.c_str(), X_OK) == -1) continue;
+
+      const auto name = strings.intern(e->d_name);
+      names.emplace(name);
+      candidates.push_back(app_t{name, strings.intern(file)});
+    }
+
+    closedir(d);
+  }
+}
+
+struct scored_t {
+  size_t score, idx;
+};
+
+// prefix matches before other substring matches, shorter names first
+static inline size_t match_score(size_t at, size_t len) noexcept
+{
+  return (at != 0) << 16 | std::min<size_t>(len, 0xFFFF);
+}
+
+// sorts the PROVIDER_RESULTS_CAP lowest scores to the front, ties in
+// candidate order, and returns how many there are
+static inline size_t best_scored(std::vector<scored_t> &scored)
+{
+  const auto n = std::min(scored.size(), PROVIDER_RESULTS_CAP);
+  std::partial_sort(scored.begin(), scored.begin() + n, scored.end(), [](const auto &a, const auto &b) {
+    return a.score != b.score ? a.score < b.score : a.idx < b.idx;
+  });
+  return n;
+}
+
+static void query_path(const std::vector<app_t> &candidates, const std::string &prompt, std::vector<app_t> &out)
+{
+  static thread_local std::vector<scored_t> scored;
+  scored.clear();
+
+  for (size_t i = 0; i < candidates.size(); ++i) {
+    const auto at = candidates[i].name.find(prompt);
+    if (at == std::string::npos) continue;
+    scored.push_back({match_score(at, candidates[i].name.size()), i});
+  }
+
+  const auto n = best_scored(scored);
+  for (size_t i = 0; i < n; ++i) out.emplace_back(candidates[scored[i].idx]);
+}
+
+// files below $RAPP_FILES_ROOT from the index the last crawl wrote, see
+// files.h, crawled first if there is none. only the results get strings,
+// the path as the name and the command opening it as the exec.
+// one per worker of file_index.pool, file_index.find() calls back on every
+// worker's own thread
+static std::vector<std::vector<scored_t>> files_scored;
+
+static inline void start_files_pool(size_t threads = 0)
+{
+  file_index.start_pool(threads);
+  files_scored.assign(file_index.pool.size(), {});
+}
+
+// a stale index answers queries until the crawl replacing it is done,
+// query_files() then swaps it in
+static file_index_t files_fresh;
+static std::thread files_refresher;
+static std::atomic<bool> files_refreshed;
+
+// a crawl of a large root outlasts a quick launch, stop_providers() must
+// not wait for it. a cancelled one leaves no index to write or query.
+static bool crawl_files(file_index_t &index, const files_config_t &config, const std::string &path)
+{
+  const auto built = realtime_ns();
+  if (!index.crawl(config, -1, &providers_stopping)) return false;
+  index.built = built;
+  index.write(path, config.hash(), built);
+  return true;
+}
+
+static void load_files(std::vector<app_t> &, strings_t &)
+{
+  const auto config = files_config();
+  const auto path = files_index_path();
+
+  if (!file_index.read(path, config.hash())) {
+    if (!crawl_files(file_index, config, path)) return;
+  } else if (file_index.stale(config)) {
+    files_refresher = std::thread([config, path] {
+      if (crawl_files(files_fresh, config, path)) files_refreshed.store(true, std::memory_order_release);
+    });
+  }
+
+  start_files_pool();
+}
+
+static void stop_files(void)
+{
+  if (files_refresher.joinable()) files_refresher.join();
+}
+
+// not through search(): it ranks by launch count and match class over
+// apps, whose names it needs whole and in memory next to the initials,
+// prefix and BKTree indices built per name. for a million paths that is
+// most of what the front coding saves. files rank like the path provider's
+// candidates, by match_score() and best_scored().
+static void query_files(const std::vector<app_t> &, const std::string &prompt, std::vector<app_t> &out)
+{
+  static thread_local std::vector<scored_t> scored;
+  static thread_local std::string lower, buf, exec;
+
+  // the strings of two queries alternate, see provider_t::query. they
+  // outlive the thread, launched_application may point into them.
+  static strings_t strings[2];
+  static size_t queries;
+
+  if (files_refreshed.exchange(false, std::memory_order_acquire)) {
+    files_refresher.join();
+    file_index.swap(files_fresh);
+    start_files_pool();
+
+    // frees the stale index
+    file_index_t stale;
+    files_fresh.swap(stale);
+  }
+
+  lower = prompt;
+  for (auto &c: lower) c = tolower((uint8_t) c);
+
+  assert(files_scored.size() == file_index.pool.size() && "start_files_pool() was not called");
+  for (auto &s: files_scored) s.clear();
+
+  file_index.find(lower, [&](size_t worker, uint32_t index, size_t at, size_t len) {
+    files_scored[worker].push_back({match_score(at, len), index});
+  });
+
+  scored.clear();
+  for (const auto &s: files_scored) scored.insert(scored.end(), s.begin(), s.end());
+
+  auto &results = strings[queries++ % 2];
+  results.clear();
+
+  const auto n = best_scored(scored);
+  for (size_t i = 0; i < n; ++i) {
+    const auto index = scored[i].idx;
+    const auto name = results.intern(file_index.path(index, buf));
+    exec_with_file(file_index.exec(index), name, exec);
+    out.push_back(app_t{name, results.intern(exec)});
+  }
+}
+
+static const provider_t PROVIDERS[] = {
+  {"path",  load_path,  query_path,  NULL},
+  {"files", load_files, query_files, stop_files},
+};
+
+struct provider_state_t {
+  const provider_t *provider;
+  std::thread thread;
+
+  std::vector<app_t> candidates;
+  strings_t strings;
+
+  // the generation results answer, and whether the main thread took them
+  uint64_t answered;
+  bool merged;
+  std::vector<app_t> results;
+};
+
+static std::vector<std::unique_ptr<provider_state_t>> providers;
+
+// guards the posted prompt and every provider's answer
+static std::mutex providers_mutex;
+static std::condition_variable providers_posted, providers_answered;
+
+static std::string posted_prompt;
+static uint64_t posted_generation;
+static uint64_t posted_at;
+
+static void run_provider(provider_state_t *state)
+{
+  state->provider->load(state->candidates, state->strings);
+
+  std::string prompt;
+  std::vector<app_t> results;
+  results.reserve(PROVIDER_RESULTS_CAP);
+
+  std::unique_lock lock(providers_mutex);
+  uint64_t generation = 0;
+  while (true) {
+    providers_posted.wait(lock, [&] { return providers_stopping || posted_generation != generation; });
+    if (providers_stopping) return;
+
+    generation = posted_generation;
+    prompt = posted_prompt;
+    lock.unlock();
+
+    results.clear();
+    if (!prompt.empty()) state->provider->query(state->candidates, prompt, results);
+
+    lock.lock();
+    state->results.swap(results);
+    state->answered = generation;
+    providers_answered.notify_all();
+  }
+}
+
+// prompt_cap keeps post_prompt() from allocating
+static inline void start_providers(size_t prompt_cap)
+{
+  const char *names = getenv("RAPP_PROVIDERS");
+  if (!names) return;
+
+  posted_prompt.reserve(prompt_cap);
+
+  std::string_view list = names;
+  while (!list.empty()) {
+    const auto end = std::min(list.find(','), list.size());
+    const auto name = list.substr(0, end);
+    list.remove_prefix(std::min(end + 1, list.size()));
+
+    const auto it = std::find_if(std::begin(PROVIDERS), std::end(PROVIDERS), [&](const auto &p) {
+      return name == p.name;
+    });
+
+    if (it == std::end(PROVIDERS)) {
+      eprintf("unknown provider in $RAPP_PROVIDERS: %.*s\n", (int) name.size(), name.data());
+      continue;
+    }
+
+    // a provider's buffers are its own thread's only
+    if (std::any_of(providers.begin(), providers.end(), [&](const auto &p) { return p->provider == it; })) {
+      continue;
+    }
+
+    auto state = std::make_unique<provider_state_t>();
+    state->provider = it;
+    state->results.reserve(PROVIDER_RESULTS_CAP);
+    state->thread = std::thread(run_provider, state.get());
+    providers.emplace_back(std::move(state));
+  }
+}
+
+// the candidates stay alive, launched_application may still point into them
+static inline void stop_providers(void)
+{
+  {
+    std::lock_guard lock(providers_mutex);
+    providers_stopping = true;
+  }
+  providers_posted.notify_all();
+
+  for (auto &state: providers) {
+    state->thread.join();
+    if (state->provider->stop) state->provider->stop();
+  }
+}
+
+// hands prompt to every provider, false if it is the prompt they already have
+static inline bool post_prompt(const std::string &prompt)
+{
+  if (providers.empty()) return false;
+
+  {
+    std::lock_guard lock(providers_mutex);
+    if (prompt == posted_prompt) return false;
+
+    posted_prompt = prompt;
+    posted_generation++;
+    for (auto &state: providers) state->merged = false;
+  }
+  providers_posted.notify_all();
+
+  posted_at = metrics::now();
+  return true;
+}
+
+// calls f with every result that arrived for the posted prompt and was not
+// taken yet, waits for the rest until the deadline or, when wait is set,
+// until every provider answered
+template <typename F>
+static inline void collect_provider_results(bool wait, F f)
+{
+  if (providers.empty()) return;
+
+  std::unique_lock lock(providers_mutex);
+  while (true) {
+    size_t pending = 0;
+    for (auto &state: providers) {
+      if (state->merged) continue;
+      if (state->answered != posted_generation) {
+        pending++;
+        continue;
+      }
+
+      state->merged = true;
+      for (const auto &app: state->results) f(app);
+    }
+
+    if (pending == 0) return;
+
+    if (wait) {
+      providers_answered.wait(lock);
+    } else {
+      const auto now = metrics::now();
+      const auto deadline = posted_at + PROVIDER_DEADLINE_NS;
+      if (now >= deadline) return;
+      providers_answered.wait_for(lock, std::chrono::nanoseconds(deadline - now));
+    }
+  }
+}
@@ -1,77 +1,37 @@
+#include <assert.h>
 #include <fcntl.h>
 #include <sys/wait.h>
-#include <sys/stat.h>
-#include <sys/mman.h>
 
 #define Font XFont
   #include <X11/Xlib.h>
   #include <X11/Xatom.h>
 #undef Font
 
+#include <atomic>
+#include <thread>
 #include <vector>
-#include <fstream>
 #include <algorithm>
-#include <filesystem>
 #include <string_view>
-#include <unordered_map>
-#include <unordered_set>
 
 #include "raylib.h"
 #include "font.h"
+#include "input.h"
+#include "trace.h"
+#include "search.h"
+#include "metrics.h"
+#include "providers.h"
+#include "completion.h"
 #include "prompt-font.h"
 
-namespace fs = std::filesystem;
+// the clipboard goes through the display and window glfw opened for raylib,
+// both getters are exported by the glfw built into libraylib.a
+extern "C" Display *glfwGetX11Display(void);
+extern "C" Window glfwGetX11Window(void *handle);
 
-#define eprintf(...) fprintf(stderr, __VA_ARGS__)
-#define shift(argc, argv) (assert(argc), argc--, *argv++)
-
-struct file_t {
-  const std::string_view sv;
-  size_t size;
-
-  inline constexpr
-  file_t(void) noexcept
-    : sv(""), size(0) {}
-
-  inline constexpr
-  file_t(const std::string_view sv, off_t size) noexcept
-    : sv(sv), size(size) {}
-
-  inline constexpr char
-  operator[](off_t offset) const noexcept
-  {
-    return sv[offset];
-  };
-
-  inline constexpr ~file_t(void)
-  {
-    char *ptr = const_cast<char *>(sv.data());
-
-    if (ptr == 0 or size == 0) return;
-
-    if (munmap(ptr, size) == -1) [[unlikely]] {
-      eprintf("could not unmap file\n");
-      exit(EXIT_FAILURE);
-    }
-
-#if not defined(NDEBUG)
-    printf("unmapped %zu bytes from %p\n", size, ptr);
-#endif
-  }
-
-  static const file_t read(const char *file_path, bool *ok);
-};
-
-struct app_t {
-  std::string name, exec;
-
-  ~app_t(void) = default;
-  
-  static const app_t parse(const char *file_path, bool *ok);
-};
 
 constexpr Color TEXT_COLOR              = {209, 184, 151, 0xFF};
 constexpr Color PCURSOR_COLOR           = {209, 184, 151, 0xAA};
+constexpr Color GHOST_TEXT_COLOR        = {209, 184, 151, 0x66};
 constexpr Color ACCENT_COLOR            = {100, 150, 170, 0xFF};
 constexpr Color HIGHLIGHT_COLOR         = { 30,  50,  57, 0xFF};
 constexpr Color SCROLLBAR_COLOR         = { 50,  70,  80, 0xFF};
@@ -96,204 +56,55 @@ constexpr float SCROLL_SPEED = 50.0;
 constexpr float INITIAL_KEY_DELAY = 0.5;
 constexpr float REPEAT_KEY_INTERVAL = 0.12;
 
-const file_t file_t::read(const char *file_path, bool *ok)
-{
-  int fd = open(file_path, O_RDONLY);
-  if (fd == -1) {
-    *ok = false;
-    return {};
-  }
-
-  struct stat file_info = {0};
-  if (fstat(fd, &file_info) == -1) {
-    *ok = false;
-    return {};
-  }
-
-  const off_t size = file_info.st_size;
-  if (size == 0) {
-    return {};
-  }
-
-  char *ptr = (char *) mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
-  if (ptr == MAP_FAILED) {
-    close(fd);
-    *ok = false;
-    return {};
-  }
+constexpr size_t PROMPT_CAP = 256;
+constexpr uint64_t PASTE_TIMEOUT_NS = 1000000000;
 
-  close(fd);
-
-  return file_t{ptr, size};
-}
-
-static inline std::vector<std::string_view>
-split(const std::string_view &sv, char delim)
-{
-  std::vector<std::string_view> ret;
-  size_t start = 0, pos = sv.find(delim);
-  while (pos != std::string::npos) {
-    ret.emplace_back(sv.data() + start, pos - start);
-    start = pos + 1;
-    pos = sv.find(delim, start);
-  }
-
-  if (start < sv.size()) {
-    ret.emplace_back(sv.data() + start, sv.size() - start);
-  }
-
-  return ret;
-}
 
-const app_t app_t::parse(const char *file_path, bool *ok)
+void launch_application(const std::string_view &command)
 {
-  auto ok_ = true;
-  const auto file = file_t::read(file_path, &ok_);
-
-  if (file.size == 0) {
-    if (!ok_) {
-      eprintf("could not read file: %s\n", file_path);
-    }
-    *ok = ok_;
-    return {};
-  }
-
-  std::string exec, name;
-  for (const auto &line: split(file.sv, '\n')) {
-    if (!name.empty() && !exec.empty()) break;
-
-    if (line.find("Name=") == 0) {
-      name = line.substr(5);
-    } else if (line.find("Exec=") == 0) {
-      exec = line.substr(5);
-    }
-  }
-
-  return app_t{name, exec};
-}
-
-static std::vector<app_t> apps;
-
-struct BKTree {
-  struct Node {
-    size_t idx;
-    std::unordered_map<size_t, Node *> children;
-
-    Node(size_t idx) : idx(idx) {}
-  };
-
-  Node *root;
-
-  BKTree(void) : root(NULL) {}
-
-  void insert(size_t idx)
-  {
-    if (!root) {
-      root = new Node(idx);
-      return;
-    }
-
-    Node *curr = root;
-    while (true) {
-      int dist = edit_distance(idx, curr->idx);
-      if (curr->children.find(dist) == curr->children.end()) {
-        curr->children[dist] = new Node(idx);
-        break;
-      }
-      curr = curr->children[dist];
-    }
-  }
-
-  std::vector<int> query(const std::string &target, int maxDist)
-  {
-    std::vector<int> ret;
-    query_rec(root, target, maxDist, ret);
-    return ret;
-  }
-
-  void query_rec(Node *node,
-                 const std::string &target,
-                 int max_dist,
-                 std::vector<int> &ret)
-  {
-    if (!node) return;
-
-    int dist = edit_distance(target, node->idx);
-    if (dist <= max_dist) {
-      ret.emplace_back(node->idx);
-    }
-
-    for (int i = dist - max_dist; i <= dist + max_dist; ++i) {
-      if (node->children.find(i) != node->children.end()) {
-        query_rec(node->children[i], target, max_dist, ret);
-      }
-    }
-  }
-
-  int edit_distance_(const std::string &a, const std::string &b) const noexcept
-  {
-    int n = a.size(), m = b.size();
-
-    if (n == 0) return m;
-    if (m == 0) return n;
+  // a replayed session only reports what it would have launched
+  if (input::replaying()) return;
 
-    std::vector<int> prev(m + 1), curr(m + 1);
-
-    for (int j = 0; j <= m; ++j) {
-      prev[j] = j;
-    }
-
-    for (int i = 1; i <= n; ++i) {
-      curr[0] = i;
-      for (int j = 1; j <= m; ++j) {
-        int cost = (a[i - 1] == b[j - 1]) ? 0 : 1;
-        curr[j] = std::min({prev[j] + 1, curr[j - 1] + 1, prev[j - 1] + cost});
-      }
-      prev.swap(curr);
-    }
-
-    return prev[m];
-  }
-
-  int edit_distance(const std::string &s, size_t idx) const noexcept
-  {
-    return edit_distance_(s, apps[idx].name);
-  }
-
-  int edit_distance(size_t a, size_t b) const noexcept
-  {
-    return edit_distance_(apps[a].name, apps[b].name);
-  }
-};
-
-void launch_application(const std::string &command)
-{
-  std::string cleaned_command = command;
-  size_t pos = cleaned_command.find('%');
-  while (pos != std::string::npos) {
-    cleaned_command.erase(pos, 2);
-    pos = cleaned_command.find('%');
-  }
+  const auto start = metrics::now();
 
+  // split the way the desktop entry spec has it: at spaces outside double
+  // quotes, inside which \ escapes the next character. %% is a literal %,
+  // every other field code is dropped.
   std::string arg = {};
   std::vector<std::string> args = {};
-  args.reserve(cleaned_command.size());
-
-  for (const auto &c: cleaned_command) {
-    if (c == ' ') {
-      if (!arg.empty()) {
+  args.reserve(command.size());
+
+  bool quoted = false, in_arg = false;
+  for (size_t i = 0; i < command.size(); ++i) {
+    const auto c = command[i];
+    if (c == '%') {
+      if (i + 1 < command.size() && command[++i] == '%') {
+        arg += '%';
+        in_arg = true;
+      }
+    } else if (c == '"') {
+      quoted = !quoted;
+      in_arg = true;
+    } else if (c == '\\' && quoted && i + 1 < command.size()) {
+      arg += command[++i];
+    } else if (c == ' ' && !quoted) {
+      if (in_arg) {
         args.emplace_back(arg);
         arg.clear();
+        in_arg = false;
       }
     } else {
       arg += c;
+      in_arg = true;
     }
   }
 
-  if (!arg.empty()) {
+  if (in_arg) {
     args.emplace_back(arg);
   }
 
+  if (args.empty()) return;
+
   pid_t pid = fork();
   if (pid == 0) {
     if (setsid() < 0) {
@@ -324,6 +135,8 @@ void launch_application(const std::string &command)
   } else if (pid < 0) {
     perror("fork failed");
   }
+
+  metrics::session.launch = metrics::now() - start;
 }
 
 static Window window;
@@ -331,8 +144,16 @@ static Display *display;
 
 static std::string prompt;
 
+// what tab or ctrl+e at the end of the prompt appends, drawn after it
+static std::string_view completion;
+
 static std::vector<size_t> filtered_apps;
 
+// results of the providers for the prompt, filtered_apps refers to them
+// past apps.size()
+static std::vector<app_t> provider_apps;
+
+
 static bool no_matches, draw_all_apps;
 
 static size_t lcursor, pcursor;
@@ -340,14 +161,14 @@ static size_t visible_start_idx, visible_end_idx;
 
 static bool lcursor_visible;
 
-static float scroll_offset;
+static bool hud_visible;
 
-static BKTree tree;
+static float scroll_offset;
 
 static size_t apps_len;
 
 static std::string_view launched_application;
-static std::unordered_map<std::string_view, size_t> ranks;
+static bool launched_provider_app;
 
 #define KEYS_OR X(KEY_A) | X(KEY_E) | X(KEY_B) | X(KEY_F) | X(KEY_P) | X(KEY_N) | X(KEY_D) | X(KEY_K)
 #define MOVEMENTS X(KEY_A, start) X(KEY_E, end) X(KEY_B, left) X(KEY_F, right) X(KEY_P, up) X(KEY_N, down)
@@ -362,40 +183,108 @@ static std::unordered_map<std::string_view, size_t> ranks;
   ACTIONS
 #undef X
 
-static inline const app_t &get_app(size_t idx)
+static std::thread index_loader;
+static std::atomic<bool> index_loaded;
+
+// main thread only: the first search ran on the loaded index, and the
+// results on screen already include the fuzzy matches
+static bool searchable, fuzzy_merged;
+
+// discovery, parsing and the history touch neither X nor GL, so they run on
+// their own thread while the window and the GL context are created. the
+// first frames show the prompt and the apps parsed so far (apps_ready),
+// searching waits until the whole index is there. the BKTree is built last
+// on the same thread, substring matches do not need it and most sessions
+// launch something before the fuzzy stage ever runs.
+static void load_index(const std::string history_path)
+{
+  TRACE_SCOPE("load_index");
+
+  const auto disk_reads = metrics::disk_reads();
+
+  {
+    TRACE_SCOPE("parse_apps");
+    parse_apps();
+  }
+
+  metrics::session.index_load = system_index.mapped() ? metrics::INDEX_MAPPED : metrics::INDEX_PARSED;
+
+  prepare_search();
+
+  {
+    TRACE_SCOPE("parse_ranks");
+    parse_ranks(history_path);
+    rank_order();
+    completions.build();
+  }
+
+  metrics::session.index_cache = metrics::disk_reads() != disk_reads ? metrics::INDEX_COLD : metrics::INDEX_WARM;
+
+  index_loaded.store(true, std::memory_order_release);
+
+  build_fuzzy_index();
+}
+
+static inline void wait_for_index(void)
 {
-  return no_matches ? apps[idx] : apps[filtered_apps[idx]];
+  if (!index_loader.joinable()) return;
+
+  TRACE_SCOPE("wait for index");
+  index_loader.join();
 }
 
-static inline void filter_apps(void)
+static inline bool index_loading(void)
 {
-  if (!prompt.empty()) {
-    filtered_apps.clear();
+  return !searchable;
+}
 
-    std::unordered_set<size_t> seen;
+static inline const app_t &get_app(size_t idx)
+{
+  if (no_matches) return apps[idx];
 
-    for (size_t i = 0; i < apps.size(); ++i) {
-      const auto &[name, exec] = apps[i];
-      if (name.find(prompt) != std::string::npos) {
-        filtered_apps.emplace_back(i);
-        seen.insert(i);
-      }
-    }
+  // the cached recents stand in for the ranked list until the index is in
+  if (draw_all_apps) {
+    if (searchable) return apps[ranked_apps[idx]];
+    return recents.empty() ? apps[idx] : recents[idx];
+  }
 
-    for (const auto match: tree.query(prompt, 4)) {
-      if (seen.count(match) == 0) {
-        filtered_apps.emplace_back(match);
-      }
+  const auto i = filtered_apps[idx];
+  return i < apps.size() ? apps[i] : provider_apps[i - apps.size()];
+}
+
+// a provider's result, which the history does not rank, rather than an app
+static inline bool is_provider_app(size_t idx)
+{
+  return !no_matches && !draw_all_apps && filtered_apps[idx] >= apps.size();
+}
+
+static inline void filter_apps(void)
+{
+  TRACE_SCOPE("filter_apps");
+
+  const auto start = metrics::now();
+
+  // while the index is loading the prompt only collects keystrokes, the
+  // main loop runs the first search once it is complete
+  if (!prompt.empty() && !index_loading()) {
+    search(prompt, filtered_apps);
+    completion = completions.complete(prompt);
+    metrics::search_latency.record(metrics::now() - start);
+    if (metrics::search.bktree_results) metrics::count_session(metrics::session.fuzzy_searches);
+    if (metrics::search.fuzzy > metrics::search.bktree_results) {
+      metrics::count_session(metrics::session.prefix_searches);
     }
 
-    if (!ranks.empty()) {
-      std::sort(filtered_apps.begin(), filtered_apps.end(), [](const auto &a, const auto &b) {
-        return ranks[apps[a].name] > ranks[apps[b].name];
-      });
+    // what the providers already answered for this prompt stays
+    if (post_prompt(prompt)) provider_apps.clear();
+    for (size_t i = 0; i < provider_apps.size(); ++i) {
+      filtered_apps.emplace_back(apps.size() + i);
     }
 
     no_matches = filtered_apps.empty();
   } else {
+    if (post_prompt(prompt)) provider_apps.clear();
+    completion = {};
     no_matches = false;
     filtered_apps.clear();
   }
@@ -405,63 +294,81 @@ static inline void filter_apps(void)
   lcursor_visible = true;
 }
 
-static std::string_view get_clipboard(bool *ok)
+// runs the search the keystrokes typed so far are waiting for, the BKTree
+// may still be building
+static inline void finish_index_load(void)
 {
-  Atom clipboard = XInternAtom(display, "CLIPBOARD", False);
-  Atom UTF8_string = XInternAtom(display, "UTF8_STRING", False);
-  Atom target_property = XInternAtom(display, "XSEL_DATA", False);
+  searchable = true;
 
-  Window owner = XGetSelectionOwner(display, clipboard);
-  if (!owner) {
-    eprintf("no clipboard owner\n");
-    XCloseDisplay(display);
-    *ok = false;
-    return {};
-  }
+  filtered_apps.reserve(apps.size() + provider_apps.capacity());
+  metrics::session.apps = apps.size();
 
-  XConvertSelection(display, clipboard, UTF8_string, target_property, window, CurrentTime);
-  XFlush(display);
+  fuzzy_merged = fuzzy_ready.load(std::memory_order_acquire);
+  if (!prompt.empty()) filter_apps();
+}
 
-  XEvent event;
-  auto ok_ = false;
-  std::string_view ret;
-  while (true) {
-    XNextEvent(display, &event);
-    if (event.type == SelectionNotify
-        && event.xselection.selection == clipboard
-        && event.xselection.property)
-    {
-      Atom type;
-      unsigned char *data = NULL;
-
-      int _format;
-      unsigned long _count, _bytes_after;
-
-      XGetWindowProperty(display,
-                         window,
-                         target_property,
-                         0, ~0, 0,
-                         AnyPropertyType,
-                         &type,
-                         &_format,
-                         &_count,
-                         &_bytes_after,
-                         &data);
-
-      if (data && type == UTF8_string) {
-        ret = (char *) data;
-        ok_ = true;
-      }
-    } break;
+// searches the prompt again once the fuzzy stage is available, keeping the
+// selection the user may have moved meanwhile
+static inline void merge_fuzzy_matches(void)
+{
+  fuzzy_merged = true;
+  if (prompt.empty()) return;
+
+  const auto old_lcursor = lcursor;
+  const auto old_scroll_offset = scroll_offset;
+
+  // the fuzzy matches go in between, the selected app is found again and
+  // stays on the same line of the window
+  const auto selected = !no_matches && lcursor < filtered_apps.size() ? filtered_apps[lcursor] : SIZE_MAX;
+
+  filter_apps();
+
+  const auto len = no_matches ? 0 : filtered_apps.size();
+  const auto it = std::find(filtered_apps.begin(), filtered_apps.end(), selected);
+  if (len && it != filtered_apps.end()) {
+    lcursor = it - filtered_apps.begin();
+    scroll_offset = std::max(0.0f, old_scroll_offset + ((float) lcursor - (float) old_lcursor) * LINE_H);
+  } else {
+    lcursor = len ? std::min(old_lcursor, len - 1) : 0;
+    scroll_offset = std::min(old_scroll_offset, (float) (len * LINE_H));
   }
+}
 
-  if (!ok_) {
-    eprintf("failed to retrieve clipboard text\n");
-    *ok = false;
-    return {};
+// enter during startup and a replay act on the complete index, fuzzy
+// matches included
+static inline void complete_index(void)
+{
+  wait_for_index();
+
+  if (!searchable) {
+    finish_index_load();
+  } else if (!fuzzy_merged) {
+    merge_fuzzy_matches();
   }
+}
 
-  return ret;
+// how many rows an empty prompt shows
+static inline size_t all_apps_len(void)
+{
+  if (searchable) return apps.size();
+  return recents.empty() ? apps_ready.load(std::memory_order_acquire) : recents.size();
+}
+
+// appends the provider results that arrived for the prompt, true if any did.
+// a replay waits for all of them to see the same results on the same frame.
+static inline bool merge_provider_results(void)
+{
+  const auto old_len = provider_apps.size();
+
+  collect_provider_results(input::replaying(), [](const app_t &app) {
+    filtered_apps.emplace_back(apps.size() + provider_apps.size());
+    provider_apps.emplace_back(app);
+  });
+
+  if (provider_apps.size() == old_len) return false;
+
+  no_matches = false;
+  return true;
 }
 
 static inline
@@ -475,21 +382,194 @@ std::string_view trim(const char *str, size_t len)
   return std::string_view(str, (size_t) (end - str));
 }
 
-namespace _pcursor {
+// the length of s without the code point its last bytes only begin
+static inline size_t utf8_whole(const std::string_view &s)
+{
+  size_t lead = s.size();
+  while (lead > 0 && s.size() - lead < 4 && ((uint8_t) s[lead - 1] & 0xC0) == 0x80) lead--;
+  if (lead == 0) return s.size();
 
-static inline void paste(void)
+  const auto c = (uint8_t) s[lead - 1];
+  const size_t len = c < 0xC0 ? 1 : c < 0xE0 ? 2 : c < 0xF0 ? 3 : 4;
+  return s.size() - (lead - 1) >= len ? s.size() : lead - 1;
+}
+
+// ctrl+y only asks the clipboard owner for the selection, poll_paste()
+// collects the answer on the following frames. glfw drains every event on
+// the display in PollInputEvents(), so rather than waiting for
+// SelectionNotify/PropertyNotify we poll the property the owner writes to.
+// large selections come in chunks (INCR), only what fits into the prompt
+// is kept. the owner still has to be taken through the rest of the chunks,
+// up to the empty one ending the transfer, but they are never read.
+static struct {
+  Atom clipboard, utf8_string, incr, property;
+  bool pending, incremental, draining;
+  uint64_t deadline;
+  std::string text;
+} pasting;
+
+static inline void stop_paste(void)
 {
-  auto ok = true;
-  const auto clipboard = get_clipboard(&ok);
-  if (ok) {
-    const auto n = clipboard.size();
-    const auto trimmed = trim(clipboard.data(), n);
+  pasting.pending = false;
+  XDeleteProperty(display, window, pasting.property);
+  XFlush(display);
+}
 
-    prompt.insert(pcursor, trimmed);
-    pcursor += n;
-    free(const_cast<char *>(clipboard.data()));
-    filter_apps();
+static void request_paste(void)
+{
+  // a replay pastes what the recording did, see poll_paste()
+  if (input::replaying()) return;
+
+  if (!pasting.clipboard) {
+    pasting.clipboard = XInternAtom(display, "CLIPBOARD", False);
+    pasting.utf8_string = XInternAtom(display, "UTF8_STRING", False);
+    pasting.incr = XInternAtom(display, "INCR", False);
+    pasting.property = XInternAtom(display, "XSEL_DATA", False);
+    pasting.text.reserve(PROMPT_CAP);
+  }
+
+  if (pasting.pending) return;
+
+  if (!XGetSelectionOwner(display, pasting.clipboard)) {
+    eprintf("no clipboard owner\n");
+    return;
+  }
+
+  XDeleteProperty(display, window, pasting.property);
+  XConvertSelection(display, pasting.clipboard, pasting.utf8_string, pasting.property, window, CurrentTime);
+  XFlush(display);
+
+  pasting.pending = true;
+  pasting.incremental = false;
+  pasting.draining = false;
+  pasting.deadline = metrics::now() + PASTE_TIMEOUT_NS;
+  pasting.text.clear();
+}
+
+static inline void insert_paste(const std::string_view &text)
+{
+  if (text.empty()) return;
+
+  input::paste(text);
+  prompt.insert(pcursor, text);
+  pcursor += text.size();
+  filter_apps();
+}
+
+static void poll_paste(void)
+{
+  if (input::replaying()) {
+    insert_paste(input::replayed_paste());
+    return;
   }
+
+  if (!pasting.pending) return;
+
+  if (metrics::now() > pasting.deadline) {
+    if (!pasting.draining) eprintf("failed to retrieve clipboard text: timed out\n");
+    stop_paste();
+    return;
+  }
+
+  const auto used = std::min(PROMPT_CAP, prompt.size() + pasting.text.size());
+  const auto room = PROMPT_CAP - used;
+
+  Atom type;
+  int format;
+  unsigned long count, bytes_after;
+  unsigned char *data = NULL;
+
+  XGetWindowProperty(display,
+                     window,
+                     pasting.property,
+                     0, pasting.draining ? 0 : room / 4 + 1, False,
+                     AnyPropertyType,
+                     &type,
+                     &format,
+                     &count,
+                     &bytes_after,
+                     &data);
+
+  // the owner has not answered yet, or not sent the next chunk
+  if (type == None) {
+    if (data) XFree(data);
+    return;
+  }
+
+  if (type == pasting.incr) {
+    // deleting the INCR property asks the owner for the first chunk
+    XFree(data);
+    XDeleteProperty(display, window, pasting.property);
+    XFlush(display);
+    pasting.incremental = true;
+    pasting.deadline = metrics::now() + PASTE_TIMEOUT_NS;
+    return;
+  }
+
+  // asked for none of it, bytes_after is the size of the chunk
+  if (pasting.draining) {
+    if (data) XFree(data);
+    if (bytes_after == 0) {
+      stop_paste();
+      return;
+    }
+
+    XDeleteProperty(display, window, pasting.property);
+    XFlush(display);
+    pasting.deadline = metrics::now() + PASTE_TIMEOUT_NS;
+    return;
+  }
+
+  if (type != pasting.utf8_string || format != 8) {
+    if (data) XFree(data);
+    eprintf("failed to retrieve clipboard text\n");
+    stop_paste();
+    return;
+  }
+
+  const char *begin = (const char *) data, *end = begin + std::min<size_t>(count, room);
+  if (pasting.text.empty()) {
+    for (; begin < end && isspace(*begin); begin++);
+  }
+  pasting.text.append(begin, end);
+  XFree(data);
+
+  // a code point cut at room, or at a chunk's end just before it, is left
+  // out whole
+  const auto full = count > room || prompt.size() + pasting.text.size() >= PROMPT_CAP;
+  if (full) pasting.text.resize(utf8_whole(pasting.text));
+  if (pasting.incremental && count > 0) {
+    // deleting the chunk asks for the next one, an empty chunk ends it.
+    // once the prompt is full the rest is only drained
+    XDeleteProperty(display, window, pasting.property);
+    XFlush(display);
+    pasting.deadline = metrics::now() + PASTE_TIMEOUT_NS;
+    if (!full) return;
+
+    pasting.draining = true;
+  } else {
+    stop_paste();
+  }
+
+  insert_paste(trim(pasting.text.data(), pasting.text.size()));
+}
+
+static inline bool accept_completion(void)
+{
+  if (completion.empty() || pcursor != prompt.size()) return false;
+
+  prompt.append(completion.substr(0, PROMPT_CAP - std::min(PROMPT_CAP, prompt.size())));
+  pcursor = prompt.size();
+  metrics::count_session(metrics::session.completions);
+  filter_apps();
+  return true;
+}
+
+namespace _pcursor {
+
+static inline void paste(void)
+{
+  request_paste();
 }
 
 static inline void pop_back(void)
@@ -564,7 +644,7 @@ static inline void start(void)
 
 static inline void end(void)
 {
-  pcursor = prompt.size();
+  if (!accept_completion()) pcursor = prompt.size();
 }
 
 static inline void left(void)
@@ -623,9 +703,9 @@ static inline void handle_key_repeat(int key,
                                      bool &repeat_active,
                                      void (*action)(void))
 {
-  const auto time = GetTime();
-  const auto key_down = IsKeyDown(key);
-  const auto key_pressed = IsKeyPressed(key);
+  const auto time = input::time();
+  const auto key_down = input::is_key_down(key);
+  const auto key_pressed = input::is_key_pressed(key);
 
   if (key_down) {
     if (!repeat_active) {
@@ -635,6 +715,7 @@ static inline void handle_key_repeat(int key,
     } else {
       if (time - last_press_time > REPEAT_KEY_INTERVAL) {
         last_press_time = time;
+        metrics::input();
         action();
       }
     }
@@ -644,22 +725,30 @@ static inline void handle_key_repeat(int key,
 
   if (key_pressed) {
     last_press_time = time;
+    metrics::input();
     action();
   }
 }
 
 static bool handle_keys(void)
 {
-  char ch = GetCharPressed();
+  char ch = input::char_pressed();
   while (ch > 0) {
-    if (ch >= 32 && ch <= 125) {
+    metrics::input();
+
+    // capped like pastes, so the prompt never outgrows what was reserved
+    if (ch >= 32 && ch <= 125 && prompt.size() < PROMPT_CAP) {
       prompt.insert(pcursor, 1, ch);
+      pcursor++;
     }
 
-    ch = GetCharPressed();
+    ch = input::char_pressed();
     filter_apps();
+  }
 
-    pcursor++;
+  if (input::is_key_pressed(KEY_TAB)) {
+    metrics::input();
+    accept_completion();
   }
 
 #define HANDLE_KEY_REPEAT(key, action) \
@@ -672,21 +761,24 @@ static bool handle_keys(void)
 
   const auto old_len = filtered_apps.size();
 
-  if (IsKeyDown(KEY_LEFT_ALT)) {
+  if (input::is_key_down(KEY_LEFT_ALT)) {
     HANDLE_KEY_REPEAT(KEY_B, word_left);
     HANDLE_KEY_REPEAT(KEY_F, word_right);
     HANDLE_KEY_REPEAT(KEY_D, delete_word_right);
   }
 
-  if (IsKeyDown(KEY_LEFT_CONTROL) or IsKeyDown(KEY_CAPS_LOCK)) {
+  if (input::is_key_down(KEY_LEFT_CONTROL) or input::is_key_down(KEY_CAPS_LOCK)) {
     HANDLE_KEY_REPEAT(KEY_Y, paste);
     HANDLE_KEY_REPEAT(KEY_D, delete_char);
     HANDLE_KEY_REPEAT(KEY_K, delete_line);
-    if (IsKeyDown(KEY_LEFT_SHIFT)) {
+    const bool shift = input::is_key_down(KEY_LEFT_SHIFT);
+    if (shift) {
       HANDLE_KEY_REPEAT(KEY_K, delete_whole_line);
+      if (input::is_key_pressed(KEY_P)) hud_visible = !hud_visible;
     }
     HANDLE_KEY_REPEAT(KEY_BACKSPACE, delete_word_left);
-#define X HANDLE_KEY_REPEAT
+    // ctrl+shift+p toggles the hud without also moving up
+#define X(key, action) if (key != KEY_P || !shift) HANDLE_KEY_REPEAT(key, action)
     MOVEMENTS
 #undef X
 
@@ -697,120 +789,213 @@ static bool handle_keys(void)
     }
   }
 
-  if (IsKeyPressed(KEY_ENTER)) {
+  if (input::is_key_pressed(KEY_ENTER)) {
+    // enter typed during startup launches what the whole index matches,
+    // once searchable it launches what is on screen
+    if (index_loading()) {
+      complete_index();
+      draw_all_apps = filtered_apps.empty() && !no_matches;
+    }
+
+    if (apps.empty()) return false;
+
     const auto &[name, exec] = get_app(lcursor);
     launch_application(exec);
     launched_application = name;
+    launched_provider_app = is_provider_app(lcursor);
+    metrics::session.rank = lcursor;
     return true;
   }
 
   return false;
 }
 
-static void parse_ranks(const std::string_view &path)
+static inline void draw_rectangle(int x, int y, int w, int h, Color color)
 {
-  auto ok = true;
-  static const auto file = file_t::read(path.data(), &ok);
-  if (!ok) return;
-
-  for (auto line: split(file.sv, '\n')) {
-    ranks[line]++;
-  }
+  metrics::frames.draws++;
+  DrawRectangle(x, y, w, h, color);
 }
 
-static void write_rank(const std::string_view &path, const std::string_view &rank)
+static inline void draw_text(const Font &font, const char *text, Vector2 pos, float size, Color color)
 {
-  std::ofstream file(std::string(path), std::ios::app);
-  if (!file.is_open()) return;
-
-  file << rank << '\n';
-  file.close();
+  metrics::frames.draws++;
+  DrawTextEx(font, text, pos, size, SPACING, color);
 }
 
-static void parse_apps(void)
+static void draw_hud(const Font &font)
 {
-  size_t apps_count = 0;
-  std::unordered_set<std::string> seen_names;
-
-  for (const auto &dir: {
-    "/usr/share/applications",
-    "/usr/local/share/applications",
-    "~/.local/share/applications"
-  }) {
-    auto path = fs::absolute(fs::path(dir));
-    if (!fs::is_directory(path)) continue;
-    for (const auto &e: fs::directory_iterator(path)) {
-      if (e.path().extension() != ".desktop") continue;
+  constexpr int HUD_FONT_SIZE = 16;
+  constexpr int HUD_LINE_H = HUD_FONT_SIZE + 2;
+  constexpr int GRAPH_H = 50;
+  constexpr int HUD_W = metrics::FRAMES_CAP * 2 + PADDING;
+  constexpr int HUD_H = GRAPH_H + 6 * HUD_LINE_H + PADDING;
+  constexpr int HUD_X = WINDOW_W - HUD_W - PADDING;
+  constexpr int HUD_Y = PROMPT_H + PADDING;
+
+  // the graph covers two 60Hz frame budgets, the line marks one
+  constexpr float GRAPH_NS = 2e9 / 60;
+
+  const auto &f = metrics::frames;
+  const auto &s = metrics::search;
+  const auto ms = [](uint64_t ns) { return ns / 1e6; };
+
+  DrawRectangle(HUD_X, HUD_Y, HUD_W, HUD_H, Fade(PROMPT_BACKGROUND_COLOR, 0.9));
+
+  const int graph_x = HUD_X + PADDING / 2, graph_y = HUD_Y + PADDING / 2;
+  for (size_t i = 0; i < metrics::FRAMES_CAP && i < f.len; ++i) {
+    const auto work = f.work[(f.len - 1 - i) % metrics::FRAMES_CAP];
+    const int h = std::min(1.0f, work / GRAPH_NS) * GRAPH_H;
+    DrawRectangle(graph_x + (metrics::FRAMES_CAP - 1 - i) * 2, graph_y + GRAPH_H - h, 2, h, ACCENT_COLOR);
+  }
+  DrawRectangle(graph_x, graph_y + GRAPH_H / 2, metrics::FRAMES_CAP * 2, 1, PCURSOR_COLOR);
 
-      auto ok = true;
-      auto [name, exec] = app_t::parse(e.path().c_str(), &ok);
+  const auto last = f.len ? (f.len - 1) % metrics::FRAMES_CAP : 0;
 
-      for (auto &c: name) c = tolower(c);
+  // formatted into one buffer and drawn one at a time, TextFormat() cycles
+  // through fewer static buffers than there are lines
+  char line[64];
+  float y = graph_y + GRAPH_H + PADDING / 2;
+  const auto draw_line = [&] {
+    DrawTextEx(font, line, {(float) graph_x, y}, HUD_FONT_SIZE, SPACING, TEXT_COLOR);
+    y += HUD_LINE_H;
+  };
 
-      if (ok && !name.empty() && !exec.empty()) {
-        if (seen_names.count(name) == 0) {
-          apps.emplace_back(name, exec);
-          seen_names.insert(name);
-          filtered_apps.emplace_back(apps_count);
-          apps_count++;
-        }
-      }
-    }
-  }
+  snprintf(line, sizeof(line), "frame %.2fms work %.3fms", ms(f.period[last]), ms(f.work[last]));
+  draw_line();
+  snprintf(line, sizeof(line), "substr %.3fms bktree %.3fms", ms(s.substring), ms(s.bktree));
+  draw_line();
+  snprintf(line, sizeof(line), "initials %.3fms prefix %.3fms", ms(s.initials), ms(s.prefix));
+  draw_line();
+  snprintf(line, sizeof(line), "sort %.3fms results %zu", ms(s.sort), s.results);
+  draw_line();
+  snprintf(line, sizeof(line), "scanned %zu visited %zu", s.scanned, s.visited);
+  draw_line();
+#if defined(RAPP_COUNT_ALLOCS)
+  snprintf(line, sizeof(line), "allocs %lu draws %zu", f.allocs, f.last_draws);
+#else
+  snprintf(line, sizeof(line), "draws %zu", f.last_draws);
+#endif
+  draw_line();
 }
 
-int main(void)
+int main(int argc, char **argv)
 {
+  const auto start = metrics::now();
+
   const char *home = std::getenv("HOME");
   if (!home) return 1;
 
-  display = XOpenDisplay(NULL);
-  window = XCreateSimpleWindow(display, DefaultRootWindow(display), 0, 0, 1, 1, 0, 0, 0);
+  std::string history_path;
+  history_path += home;
+  history_path += "/.local/share/rapp_history";
 
-  if (!display) {
-    eprintf("could not open X display\n");
+  std::string sessions_path;
+  sessions_path += home;
+  sessions_path += "/.local/share/rapp_sessions";
+
+  std::string recents_path;
+  recents_path += home;
+  recents_path += "/.cache/rapp_recents";
+
+  const char *program = shift(argc, argv);
+  if (argc > 0) {
+    const std::string_view flag = shift(argc, argv);
+    if (flag == "--stats") {
+      const size_t last = argc > 0 ? strtoul(shift(argc, argv), NULL, 10) : 100;
+      return metrics::print_stats(sessions_path.c_str(), last ? last : 100);
+    }
+
+    if (flag == "--build-system-index") {
+      const char *path = argc > 0 ? shift(argc, argv) : SYSTEM_INDEX_PATH;
+      return build_system_index(path) ? 0 : 1;
+    }
+
+    if (flag == "--files-daemon") {
+      return run_files_daemon();
+    }
+
+    eprintf("usage: %s [--stats [last_n_sessions] | --build-system-index [path] | --files-daemon]\n", program);
     return 1;
   }
 
+  if (!input::open()) return 1;
+
+  parse_recents(recents_path);
+
+  index_loader = std::thread(load_index, history_path);
+
+  start_providers(PROMPT_CAP);
+  provider_apps.reserve(providers.size() * PROVIDER_RESULTS_CAP);
+
   SetTargetFPS(60);
   SetConfigFlags(FLAG_MSAA_4X_HINT);
-  InitWindow(WINDOW_W, WINDOW_H, "rapp");
+  {
+    TRACE_SCOPE("InitWindow");
+    InitWindow(WINDOW_W, WINDOW_H, "rapp");
+  }
+
+  if (!IsWindowReady() || !(display = glfwGetX11Display())) {
+    eprintf("could not open X display\n");
+    fuzzy_cancel = true;
+    wait_for_index();
+    stop_providers();
+    return 1;
+  }
+
+  window = glfwGetX11Window(GetWindowHandle());
+
   SetTargetFPS(GetMonitorRefreshRate(GetCurrentMonitor()));
 
-  const Font font = LoadFont_Default();
-  const Font prompt_font = LoadFont_Prompt();
+  Font font, prompt_font;
+  {
+    TRACE_SCOPE("LoadFont");
+    font = LoadFont_Default();
+    prompt_font = LoadFont_Prompt();
+  }
 
   const int m = GetCurrentMonitor();
   const int monitor_w = GetMonitorWidth(m), monitor_h = GetMonitorHeight(m);
 
   SetWindowPosition((monitor_w - WINDOW_W) / 2, (monitor_h - WINDOW_H) / 2);
 
-  parse_apps();
-
-  for (size_t i = 0; i < apps.size(); ++i) {
-    tree.insert(i);
-  }
-
-  std::string history_path;
-  history_path += home;
-  history_path += "/.local/share/rapp_history";
-
-  parse_ranks(history_path.c_str());
+  // a replay has to search the same index on the same frames
+  if (input::replaying()) complete_index();
 
-  prompt.reserve(256);
+  prompt.reserve(PROMPT_CAP);
 
   float drag_offset = 0.0;
   bool dragging_scrollbar = false;
 
+  size_t frames = 0;
+
   while (!WindowShouldClose()) {
-    apps_len = draw_all_apps ? apps.size() : filtered_apps.size();
+    metrics::frame_begin();
+
+    if (!input::next()) goto end;
+
+    poll_paste();
+
+    if (!searchable && index_loaded.load(std::memory_order_acquire)) {
+      finish_index_load();
+    }
+
+    if (searchable && !fuzzy_merged && fuzzy_ready.load(std::memory_order_acquire)) {
+      merge_fuzzy_matches();
+    }
+
     draw_all_apps = filtered_apps.empty() && !no_matches;
+    apps_len = draw_all_apps ? all_apps_len() : filtered_apps.size();
 
     if (handle_keys()) goto end;
 
+    if (searchable && merge_provider_results()) {
+      draw_all_apps = filtered_apps.empty() && !no_matches;
+      apps_len = filtered_apps.size();
+    }
+
     // handle mouse wheel
     {
-      scroll_offset -= GetMouseWheelMove() * SCROLL_SPEED;
+      scroll_offset -= input::mouse_wheel_move() * SCROLL_SPEED;
       scroll_offset = std::max(scroll_offset, 0.0f);
       scroll_offset = std::min(scroll_offset, (float) ((apps_len * LINE_H) - (WINDOW_H - PROMPT_H) + PADDING));
     }
@@ -821,16 +1006,16 @@ int main(void)
 
       const Rectangle scrollbar_rect = {WINDOW_W - 20, PROMPT_H + scrollbar_y, PROMPT_W, scrollbar_h};
 
-      const Vector2 mouse_pos = GetMousePosition();
+      const Vector2 mouse_pos = input::mouse_position();
 
       const auto hovering_scrollbar = CheckCollisionPointRec(mouse_pos, scrollbar_rect);
 
-      if (hovering_scrollbar && IsMouseButtonPressed(MOUSE_BUTTON_LEFT)) {
+      if (hovering_scrollbar && input::is_mouse_button_pressed()) {
         dragging_scrollbar = true;
         drag_offset = mouse_pos.y - scrollbar_y;
       }
 
-      if (dragging_scrollbar && IsMouseButtonReleased(MOUSE_BUTTON_LEFT)) {
+      if (dragging_scrollbar && input::is_mouse_button_released()) {
         dragging_scrollbar = false;
       }
 
@@ -841,7 +1026,7 @@ int main(void)
         scroll_offset = (new_scrollbar_y - PROMPT_H) / ((WINDOW_H - PROMPT_H) - scrollbar_h) * ((apps_len * LINE_H) - (WINDOW_H - PROMPT_H));
       }
 
-      if (!dragging_scrollbar && IsMouseButtonPressed(MOUSE_BUTTON_LEFT)) {
+      if (!dragging_scrollbar && input::is_mouse_button_pressed()) {
         if (mouse_pos.x >= scrollbar_rect.x                        &&
             mouse_pos.x <= scrollbar_rect.x + scrollbar_rect.width &&
             mouse_pos.y >= PROMPT_H                                &&
@@ -858,7 +1043,7 @@ int main(void)
     BeginDrawing();
     ClearBackground(BACKGROUND_COLOR);
 
-    DrawRectangle(0, 0, WINDOW_W, PROMPT_H, PROMPT_BACKGROUND_COLOR);
+    draw_rectangle(0, 0, WINDOW_W, PROMPT_H, PROMPT_BACKGROUND_COLOR);
 
     const char *prompt_text = "search: ";
     auto prompt_text_color = TEXT_COLOR;
@@ -871,32 +1056,40 @@ int main(void)
     const auto mid_prompt_y = (PROMPT_H - PROMPT_FONT_SIZE) / 2;
 
     // cursor
-    DrawRectangle(PADDING + PCURSOR_W * pcursor, mid_prompt_y, PCURSOR_W, PCURSOR_H, PCURSOR_COLOR);
+    draw_rectangle(PADDING + PCURSOR_W * pcursor, mid_prompt_y, PCURSOR_W, PCURSOR_H, PCURSOR_COLOR);
+
+    draw_text(prompt_font, prompt_text, {PADDING, mid_prompt_y}, PROMPT_FONT_SIZE, prompt_text_color);
 
-    DrawTextEx(prompt_font, prompt_text, {PADDING, mid_prompt_y}, PROMPT_FONT_SIZE, SPACING, prompt_text_color);
+    if (!completion.empty() && pcursor == prompt.size()) {
+      const Vector2 ghost_pos = {PADDING + (float) PCURSOR_W * prompt.size(), mid_prompt_y};
+      draw_text(prompt_font, completion.data(), ghost_pos, PROMPT_FONT_SIZE, GHOST_TEXT_COLOR);
+    }
 
     int y = PROMPT_H + PADDING / 3;
 
     if (no_matches) {
-      DrawRectangle(0, y, WINDOW_W, LINE_H, BACKGROUND_COLOR);
-      DrawTextEx(font, "[no matches]", {PADDING, (float) y}, FONT_SIZE, SPACING, TEXT_COLOR);
+      draw_rectangle(0, y, WINDOW_W, LINE_H, BACKGROUND_COLOR);
+      draw_text(font, "[no matches]", {PADDING, (float) y}, FONT_SIZE, TEXT_COLOR);
     } else {
       const int start_idx = std::max(0, (int) (scroll_offset / LINE_H));
       const int end_idx = std::min((int) apps_len, (int) ((scroll_offset + (WINDOW_H - PROMPT_H)) / LINE_H));
   
       for (int i = start_idx; i < end_idx; ++i) {
         const auto &[name, exec] = get_app(i);
-        const auto hovered = GetMouseY() > y && GetMouseY() < y + LINE_H;
+        const int mouse_x = input::mouse_position().x, mouse_y = input::mouse_position().y;
+        const auto hovered = mouse_y > y && mouse_y < y + LINE_H;
         if (lcursor == (size_t) i or hovered) {
-          DrawRectangle(0, y - PADDING / 3, WINDOW_W, LINE_H, HIGHLIGHT_COLOR);
-          if (hovered && GetMouseX() < WINDOW_W - 20 && IsMouseButtonPressed(MOUSE_BUTTON_LEFT)) {
+          draw_rectangle(0, y - PADDING / 3, WINDOW_W, LINE_H, HIGHLIGHT_COLOR);
+          if (hovered && mouse_x < WINDOW_W - 20 && input::is_mouse_button_pressed()) {
             launch_application(exec);
             launched_application = name;
+            launched_provider_app = is_provider_app(i);
+            metrics::session.rank = i;
             goto end;
           }
         }
   
-        DrawTextEx(font, name.c_str(), {PADDING, (float) y}, FONT_SIZE, SPACING, TEXT_COLOR);
+        draw_text(font, name.data(), {PADDING, (float) y}, FONT_SIZE, TEXT_COLOR);
         y += LINE_H;
       }
     }
@@ -904,20 +1097,59 @@ int main(void)
     if (apps_len * LINE_H > (WINDOW_H - PROMPT_H)) {
       const float scrollbar_h = (WINDOW_H - PROMPT_H) / (float) (apps_len * LINE_H) * (WINDOW_H - PROMPT_H);
       const float scrollbar_y = scroll_offset / (float) ((apps_len * LINE_H) - (WINDOW_H - PROMPT_H)) * ((WINDOW_H - PROMPT_H) - scrollbar_h);
-      DrawRectangle(WINDOW_W - 20, PROMPT_H + scrollbar_y, PROMPT_W, scrollbar_h, SCROLLBAR_COLOR);
+      draw_rectangle(WINDOW_W - 20, PROMPT_H + scrollbar_y, PROMPT_W, scrollbar_h, SCROLLBAR_COLOR);
+    }
+
+    if (hud_visible) {
+      draw_hud(prompt_font);
+    }
+
+    metrics::frame_submit();
+
+    {
+      TRACE_SCOPE(frames == 0 ? "first EndDrawing" : "EndDrawing");
+      EndDrawing();
     }
 
-    EndDrawing();
+    metrics::presented();
+
+    if (frames == 0) {
+      metrics::session.first_frame = metrics::frames.last_present - start;
+    }
+
+    frames++;
   }
 
 end:
+  fuzzy_cancel = true;
+  wait_for_index();
+  stop_providers();
+
   CloseWindow();
-  XDestroyWindow(display, window);
-  XCloseDisplay(display);
 
-  if (!launched_application.empty()) {
-    write_rank(history_path, launched_application);
+  if (input::replaying()) {
+    eprintf("replay: frames=%lu prompt=\"%s\" lcursor=%zu scroll_offset=%.1f results=%zu launched=\"%.*s\"\n",
+            input::frames,
+            prompt.c_str(),
+            lcursor,
+            scroll_offset,
+            no_matches ? 0 : filtered_apps.empty() ? apps.size() : filtered_apps.size(),
+            (int) launched_application.size(),
+            launched_application.data());
+  } else {
+    if (!launched_application.empty() && !launched_provider_app) {
+      write_rank(history_path, launched_application);
+      if (searchable) promote_app(launched_application);
+    }
+
+    if (searchable) write_recents(recents_path);
   }
 
+  input::close();
+
+  TRACE_DUMP();
+  metrics::report();
+  if (!input::replaying()) metrics::write_session(sessions_path.c_str());
+
   return 0;
 }
@@ -0,0 +1,509 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <algorithm>
+
+#include "apps.h"
+#include "pool.h"
+#include "trace.h"
+#include "metrics.h"
+
+struct BKTree {
+  struct Node {
+    size_t idx;
+    std::unordered_map<size_t, Node *> children;
+
+    Node(size_t idx) : idx(idx) {}
+  };
+
+  Node *root;
+
+  BKTree(void) : root(NULL) {}
+
+  void clear(void)
+  {
+    clear_rec(root);
+    root = NULL;
+  }
+
+  void clear_rec(Node *node)
+  {
+    if (!node) return;
+
+    for (const auto &[_, child]: node->children) {
+      clear_rec(child);
+    }
+
+    delete node;
+  }
+
+  void insert(size_t idx)
+  {
+    if (!root) {
+      root = new Node(idx);
+      return;
+    }
+
+    Node *curr = root;
+    while (true) {
+      int dist = edit_distance(idx, curr->idx);
+      if (curr->children.find(dist) == curr->children.end()) {
+        curr->children[dist] = new Node(idx);
+        break;
+      }
+      curr = curr->children[dist];
+    }
+  }
+
+  void query(const std::string &target, int max_dist, std::vector<size_t> &ret)
+  {
+    query_rec(root, target, max_dist, ret);
+  }
+
+  void query_rec(Node *node,
+                 const std::string &target,
+                 int max_dist,
+                 std::vector<size_t> &ret)
+  {
+    if (!node) return;
+
+    metrics::search.visited++;
+
+    int dist = edit_distance(target, node->idx);
+    if (dist <= max_dist) {
+      ret.emplace_back(node->idx);
+    }
+
+    for (int i = dist - max_dist; i <= dist + max_dist; ++i) {
+      const auto it = node->children.find(i);
+      if (it != node->children.end()) {
+        query_rec(it->second, target, max_dist, ret);
+      }
+    }
+  }
+
+  int edit_distance_(const std::string_view &a_, const std::string_view &b_) const noexcept
+  {
+    // keep the rows over the shorter string, so they fit on the stack
+    const auto &a = a_.size() < b_.size() ? b_ : a_;
+    const auto &b = a_.size() < b_.size() ? a_ : b_;
+
+    int n = a.size(), m = b.size();
+
+    if (n == 0) return m;
+    if (m == 0) return n;
+
+    constexpr int ROW_CAP = 256;
+
+    int rows[2 * ROW_CAP];
+    std::vector<int> rows_;
+    int *prev = rows, *curr = rows + ROW_CAP;
+    if (m + 1 > ROW_CAP) [[unlikely]] {
+      rows_.resize(2 * (m + 1));
+      prev = rows_.data();
+      curr = prev + m + 1;
+    }
+
+    for (int j = 0; j <= m; ++j) {
+      prev[j] = j;
+    }
+
+    for (int i = 1; i <= n; ++i) {
+      curr[0] = i;
+      for (int j = 1; j <= m; ++j) {
+        int cost = (a[i - 1] == b[j - 1]) ? 0 : 1;
+        curr[j] = std::min({prev[j] + 1, curr[j - 1] + 1, prev[j - 1] + cost});
+      }
+      std::swap(prev, curr);
+    }
+
+    return prev[m];
+  }
+
+  int edit_distance(const std::string &s, size_t idx) const noexcept
+  {
+    return edit_distance_(s, apps[idx].name);
+  }
+
+  int edit_distance(size_t a, size_t b) const noexcept
+  {
+    return edit_distance_(apps[a].name, apps[b].name);
+  }
+};
+
+static BKTree tree;
+
+// the BKTree is built after everything else, searches leave out fuzzy
+// matches until it is ready
+static std::atomic<bool> fuzzy_ready, fuzzy_cancel;
+
+// apps whose initials start with the prompt: "vsc" finds "visual studio
+// code", "lo" finds "LibreOffice". apps are kept sorted by their initials,
+// so a query is a binary search and a walk over the hits.
+struct initials_index_t {
+  // initials taken from the lowercased names, for apps without parsed ones
+  strings_t strings;
+  std::vector<std::string_view> initials;
+  std::vector<uint32_t> sorted;
+
+  void build(void)
+  {
+    TRACE_SCOPE("initials_index_t::build");
+
+    clear();
+    initials.reserve(apps.size());
+
+    const auto parsed = app_initials.size() == apps.size();
+    std::string derived;
+    for (size_t i = 0; i < apps.size(); ++i) {
+      if (parsed) {
+        initials.emplace_back(app_initials[i]);
+      } else {
+        initials_of(apps[i].name, derived);
+        initials.emplace_back(strings.intern(derived));
+      }
+    }
+
+    sorted.resize(apps.size());
+    std::iota(sorted.begin(), sorted.end(), 0);
+    std::sort(sorted.begin(), sorted.end(), [&](const auto a, const auto b) {
+      return initials[a] != initials[b] ? initials[a] < initials[b] : a < b;
+    });
+  }
+
+  void clear(void)
+  {
+    strings.clear();
+    initials = {};
+    sorted = {};
+  }
+
+  // in initials order, so an exact hit leads
+  void query(const std::string &prompt, std::vector<size_t> &out) const
+  {
+    auto it = std::lower_bound(sorted.begin(), sorted.end(), prompt, [&](const auto i, const auto &p) {
+      return initials[i] < p;
+    });
+
+    for (; it != sorted.end() && initials[*it].starts_with(prompt); ++it) {
+      out.emplace_back(*it);
+    }
+  }
+};
+
+static initials_index_t initials_index;
+
+// a single character would be the initial of half the apps
+constexpr size_t INITIALS_MIN_PROMPT = 2;
+
+// typo tolerant search as you type: every name with a prefix within
+// prefix_max_dist() edits of the prompt, "firw" finds "firefox". the names
+// sorted are an implicit trie, a node is the range of names that share a
+// prefix and its children are found by binary search. the walk carries the
+// Levenshtein automaton's state for the prefix, one DP row, and drops a
+// whole subtree once no entry of the row is within the distance.
+constexpr size_t FUZZY_PREFIX_MIN = 4;
+constexpr size_t FUZZY_PREFIX_MAX = 32;
+
+// -1 when the prompt is too short to tell a typo from another name, or too
+// long to be typed as a prefix
+static inline int prefix_max_dist(size_t len)
+{
+  if (len < FUZZY_PREFIX_MIN || len > FUZZY_PREFIX_MAX) return -1;
+  return len < 8 ? 1 : 2;
+}
+
+struct prefix_index_t {
+  static constexpr size_t ROW_CAP = FUZZY_PREFIX_MAX + 1;
+  static constexpr size_t DEPTH_CAP = FUZZY_PREFIX_MAX + 2 + 1;
+
+  std::vector<uint32_t> sorted;
+
+  void build(void)
+  {
+    TRACE_SCOPE("prefix_index_t::build");
+
+    sorted.resize(apps.size());
+    std::iota(sorted.begin(), sorted.end(), 0);
+    std::sort(sorted.begin(), sorted.end(), [](const auto a, const auto b) {
+      return apps[a].name < apps[b].name;
+    });
+  }
+
+  void clear(void)
+  {
+    sorted = {};
+  }
+
+  inline uint8_t at(size_t r, size_t depth) const noexcept
+  {
+    return apps[sorted[r]].name[depth];
+  }
+
+  template <typename F>
+  void query(const std::string &prompt, F f) const
+  {
+    const int max_dist = prefix_max_dist(prompt.size());
+    if (max_dist < 0 || sorted.empty()) return;
+
+    int rows[DEPTH_CAP * ROW_CAP];
+    for (size_t i = 0; i <= prompt.size(); ++i) rows[i] = i;
+
+    walk(prompt, max_dist, 0, sorted.size(), 0, rows, f);
+  }
+
+  // row holds the distances of every prompt prefix to the names' common
+  // prefix of length depth, the next rows go after it
+  template <typename F>
+  void walk(const std::string &prompt, int max_dist, size_t lo, size_t hi, size_t depth, int *row, F &f) const
+  {
+    const size_t m = prompt.size();
+
+    metrics::search.visited++;
+
+    if (row[m] <= max_dist) {
+      for (size_t r = lo; r < hi; ++r) f(sorted[r]);
+      return;
+    }
+
+    if (depth + 1 >= DEPTH_CAP) return;
+
+    // the names that end here sort first
+    while (lo < hi && apps[sorted[lo]].name.size() == depth) lo++;
+
+    int *next = row + ROW_CAP;
+    while (lo < hi) {
+      const auto c = at(lo, depth);
+      const auto end = std::partition_point(sorted.begin() + lo, sorted.begin() + hi, [&](const auto i) {
+        return (uint8_t) apps[i].name[depth] <= c;
+      }) - sorted.begin();
+
+      next[0] = depth + 1;
+      int best = next[0];
+      for (size_t i = 1; i <= m; ++i) {
+        next[i] = std::min({row[i] + 1, next[i - 1] + 1, row[i - 1] + ((uint8_t) prompt[i - 1] != c)});
+        best = std::min(best, next[i]);
+      }
+
+      if (best <= max_dist) walk(prompt, max_dist, lo, end, depth + 1, next, f);
+      lo = end;
+    }
+  }
+};
+
+static prefix_index_t prefix_index;
+
+// what search() found an app with, better classes go first among equal
+// launch counts
+enum match_t : uint8_t {
+  MATCH_NONE,
+  MATCH_FUZZY,
+  MATCH_SUBSTRING,
+  MATCH_INITIALS,
+};
+
+// search scratch, sized by build_index() so that search() never allocates
+static std::vector<size_t> fuzzy_matches;
+static std::vector<uint8_t> seen;
+
+// corpora this large have their substring scan split into chunks over a
+// pool of threads. a chunk's names and app_t fit in L2, and threads claim
+// the next chunk as they finish one, so a thread that got the long names
+// does not hold up the rest.
+constexpr size_t PARALLEL_MIN_APPS = 65536;
+constexpr size_t SEARCH_CHUNK = 4096;
+
+static pool_t search_pool;
+static size_t search_chunk = SEARCH_CHUNK;
+static std::atomic<size_t> next_chunk;
+
+// chunk c writes its matches from chunk_matches[c * search_chunk] on, they
+// are concatenated in chunk order so the result matches substring_scan()
+static std::vector<size_t> chunk_matches, chunk_lens;
+
+static inline void start_search_pool(size_t threads, size_t chunk = SEARCH_CHUNK)
+{
+  search_chunk = chunk;
+  chunk_matches.resize(apps.size());
+  chunk_lens.resize((apps.size() + chunk - 1) / chunk);
+  search_pool.start(threads);
+}
+
+static inline void prepare_search(void)
+{
+  fuzzy_matches.reserve(apps.size());
+  seen.resize(apps.size());
+  initials_index.build();
+  prefix_index.build();
+
+  if (apps.size() >= PARALLEL_MIN_APPS) {
+    start_search_pool(std::thread::hardware_concurrency());
+  }
+}
+
+// may run on another thread than search(), fuzzy_cancel stops it early
+static inline void build_fuzzy_index(void)
+{
+  TRACE_SCOPE("BKTree::insert");
+
+  for (size_t i = 0; i < apps.size(); ++i) {
+    if (fuzzy_cancel.load(std::memory_order_relaxed)) return;
+    tree.insert(i);
+  }
+
+  fuzzy_ready.store(true, std::memory_order_release);
+}
+
+static inline void build_index(void)
+{
+  prepare_search();
+  build_fuzzy_index();
+}
+
+// build_index() with the parallel scan regardless of the corpus size
+static inline void build_parallel_index(size_t threads, size_t chunk = SEARCH_CHUNK)
+{
+  prepare_search();
+  start_search_pool(threads, chunk);
+  build_fuzzy_index();
+}
+
+static inline void drop_index(void)
+{
+  fuzzy_ready = false;
+  search_pool.stop();
+  tree.clear();
+  initials_index.clear();
+  prefix_index.clear();
+  fuzzy_matches = {};
+  seen = {};
+  chunk_matches = {};
+  chunk_lens = {};
+}
+
+// both scans skip the initials matches already in out, so out never holds
+// more than apps.size() entries
+static inline void substring_scan(const std::string &prompt, std::vector<size_t> &out)
+{
+  for (size_t i = 0; i < apps.size(); ++i) {
+    const auto &[name, exec] = apps[i];
+    if (seen[i] != MATCH_INITIALS && name.find(prompt) != std::string::npos) {
+      out.emplace_back(i);
+    }
+  }
+}
+
+static inline void parallel_substring_scan(const std::string &prompt, std::vector<size_t> &out)
+{
+  const auto chunks = chunk_lens.size();
+
+  next_chunk.store(0, std::memory_order_relaxed);
+  search_pool.run([&](size_t) {
+    for (size_t c; (c = next_chunk.fetch_add(1, std::memory_order_relaxed)) < chunks;) {
+      const auto begin = c * search_chunk;
+      const auto end = std::min(begin + search_chunk, apps.size());
+
+      auto *matches = chunk_matches.data() + begin;
+      size_t len = 0;
+      for (size_t i = begin; i < end; ++i) {
+        if (seen[i] != MATCH_INITIALS && apps[i].name.find(prompt) != std::string::npos) {
+          matches[len++] = i;
+        }
+      }
+      chunk_lens[c] = len;
+    }
+  });
+
+  for (size_t c = 0; c < chunks; ++c) {
+    const auto *matches = chunk_matches.data() + c * search_chunk;
+    out.insert(out.end(), matches, matches + chunk_lens[c]);
+  }
+}
+
+// initials matches, then substring matches that are not initials matches,
+// then the fuzzy matches that are neither: names with a prefix within
+// prefix_max_dist() of the prompt and BKTree matches within distance 4. with a history
+// everything is ordered by launch count, then by that match class and then
+// by index among equal counts.
+static inline void search(const std::string &prompt, std::vector<size_t> &out)
+{
+  metrics::search.visited = 0;
+  metrics::search.fuzzy = 0;
+  metrics::search.bktree_results = 0;
+  metrics::search.initials = 0;
+  metrics::search.prefix = 0;
+  metrics::search.bktree = 0;
+  metrics::search.scanned = apps.size();
+
+  out.clear();
+
+  if (prompt.size() >= INITIALS_MIN_PROMPT) {
+    TRACE_SCOPE("initials");
+    const metrics::stage_t stage{metrics::search.initials};
+    initials_index.query(prompt, out);
+  }
+
+  const auto initials_matches = out.size();
+  for (size_t i = 0; i < initials_matches; ++i) {
+    seen[out[i]] = MATCH_INITIALS;
+  }
+
+  {
+    TRACE_SCOPE("substring scan");
+    const metrics::stage_t stage{metrics::search.substring};
+    if (search_pool.started()) {
+      parallel_substring_scan(prompt, out);
+    } else {
+      substring_scan(prompt, out);
+    }
+  }
+
+  const auto substring_matches = out.size();
+  for (size_t i = initials_matches; i < substring_matches; ++i) {
+    seen[out[i]] = MATCH_SUBSTRING;
+  }
+
+  const auto add_fuzzy = [&](const size_t match) {
+    if (seen[match] == MATCH_NONE) {
+      seen[match] = MATCH_FUZZY;
+      out.emplace_back(match);
+    }
+  };
+
+  {
+    TRACE_SCOPE("fuzzy prefix");
+    const metrics::stage_t stage{metrics::search.prefix};
+    prefix_index.query(prompt, add_fuzzy);
+  }
+
+  if (fuzzy_ready.load(std::memory_order_acquire)) {
+    TRACE_SCOPE("BKTree::query");
+    const metrics::stage_t stage{metrics::search.bktree};
+    fuzzy_matches.clear();
+    tree.query(prompt, 4, fuzzy_matches);
+
+    const auto prefix_matches = out.size();
+    for (const auto match: fuzzy_matches) add_fuzzy(match);
+    metrics::search.bktree_results = out.size() - prefix_matches;
+  }
+
+  metrics::search.fuzzy = out.size() - substring_matches;
+
+  // seen still holds the match classes
+  if (!ranks.empty()) {
+    TRACE_SCOPE("rank sort");
+    const metrics::stage_t stage{metrics::search.sort};
+    std::sort(out.begin(), out.end(), [](const auto &a, const auto &b) {
+      if (app_ranks[a] != app_ranks[b]) return app_ranks[a] > app_ranks[b];
+      if (seen[a] != seen[b]) return seen[a] > seen[b];
+      return a < b;
+    });
+  }
+
+  for (const auto i: out) {
+    seen[i] = MATCH_NONE;
+  }
+
+  metrics::search.results = out.size();
+}
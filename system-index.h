@@ -0,0 +1,302 @@
+#pragma once
+
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <string_view>
+
+// `rapp --build-system-index`, run from a package manager hook, writes the
+// entries of $XDG_DATA_DIRS into one immutable file that every user's rapp
+// maps read-only. the parsed system entries then live once in the page
+// cache instead of once per user, each user only parses $XDG_DATA_HOME on
+// top of it. an index is ignored, and the dirs parsed instead, when the
+// dirs it was built from are not next to each other and in the same order
+// in the user's $XDG_DATA_DIRS, or when any dir discovery walked (subdirs
+// included) was modified after it was built. the user's dirs it was not
+// built from are parsed too, their entries win over its own when they come
+// first and lose when they come after them.
+//
+// layout: header, the dirs it was built from, then every dir walked below
+// them, the entries, then the nul terminated strings the dirs and entries
+// point into by offset.
+
+constexpr const char *SYSTEM_INDEX_PATH = "/var/cache/rapp/index";
+
+constexpr uint32_t SYSTEM_INDEX_MAGIC = 0x58444952; // "RIDX"
+constexpr uint32_t SYSTEM_INDEX_VERSION = 3;
+
+struct system_index_header_t {
+  uint32_t magic, version;
+  uint64_t built;         // CLOCK_REALTIME ns, taken before discovery
+  uint32_t dirs_len, walked_len;
+  uint32_t entries_len;
+  uint32_t strings_size;
+};
+
+struct system_index_dir_t {
+  uint32_t path, path_len;
+};
+
+struct system_index_entry_t {
+  uint32_t id, id_len;
+  uint32_t name, name_len;
+  uint32_t exec, exec_len;
+  uint32_t initials, initials_len;
+};
+
+struct system_entry_t {
+  std::string_view id, name, exec, initials;
+};
+
+static inline uint64_t realtime_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// fnv-1a over the dirs in precedence order
+static inline uint64_t hash_dirs(const std::vector<std::string> &dirs)
+{
+  uint64_t h = 0xcbf29ce484222325;
+  for (const auto &dir: dirs) {
+    for (const auto c: dir) {
+      h = (h ^ (uint8_t) c) * 0x100000001b3;
+    }
+    h = (h ^ ':') * 0x100000001b3;
+  }
+  return h;
+}
+
+struct system_index_t {
+  const system_index_header_t *header = NULL;
+  const system_index_dir_t *dirs = NULL;
+  const system_index_entry_t *entries = NULL;
+  const char *strings = NULL;
+
+  inline bool mapped(void) const noexcept
+  {
+    return header != NULL;
+  }
+
+  inline size_t size(void) const noexcept
+  {
+    return header ? header->entries_len : 0;
+  }
+
+  inline system_entry_t entry(size_t i) const noexcept
+  {
+    const auto &e = entries[i];
+    return {
+      .id = std::string_view(strings + e.id, e.id_len),
+      .name = std::string_view(strings + e.name, e.name_len),
+      .exec = std::string_view(strings + e.exec, e.exec_len),
+      .initials = std::string_view(strings + e.initials, e.initials_len),
+    };
+  }
+
+  // whether dir is one of the applications dirs the index was built from
+  bool has_dir(const std::string_view &dir) const noexcept
+  {
+    for (size_t i = 0; header && i < header->dirs_len; ++i) {
+      if (std::string_view(strings + dirs[i].path, dirs[i].path_len) == dir) return true;
+    }
+    return false;
+  }
+
+  // a dir modified after the index was built may hold entries it lacks
+  static bool stale(const system_index_header_t *h, const system_index_dir_t *ds, const char *ss)
+  {
+    for (size_t i = 0; i < (size_t) h->dirs_len + h->walked_len; ++i) {
+      struct stat st;
+      if (stat(ss + ds[i].path, &st) == -1) continue;
+
+      const uint64_t mtime = (uint64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+      if (mtime > h->built) return true;
+    }
+    return false;
+  }
+
+  // the dirs the index was built from must be a run of the user's, in the
+  // same order, so that it resolved duplicates the way they would and every
+  // other dir of theirs comes either before or after all of its entries
+  static bool covered(const system_index_header_t *h,
+                      const system_index_dir_t *ds,
+                      const char *ss,
+                      const std::vector<std::string> &user_dirs)
+  {
+    if (h->dirs_len == 0) return true;
+
+    const auto first = std::find(user_dirs.begin(), user_dirs.end(), std::string_view(ss + ds[0].path, ds[0].path_len));
+    if ((size_t) (user_dirs.end() - first) < h->dirs_len) return false;
+
+    for (size_t i = 1; i < h->dirs_len; ++i) {
+      if (first[i] != std::string_view(ss + ds[i].path, ds[i].path_len)) return false;
+    }
+    return true;
+  }
+
+  bool valid(const system_index_header_t *h, size_t size, const std::vector<std::string> &user_dirs) const
+  {
+    if (h->magic != SYSTEM_INDEX_MAGIC || h->version != SYSTEM_INDEX_VERSION) return false;
+
+    const auto dirs_len = (size_t) h->dirs_len + h->walked_len;
+    const auto entries_at = sizeof(*h) + dirs_len * sizeof(system_index_dir_t);
+    const auto strings_at = entries_at + (size_t) h->entries_len * sizeof(system_index_entry_t);
+    if (strings_at + h->strings_size != size) return false;
+
+    const auto *ds = (const system_index_dir_t *) (h + 1);
+    for (size_t i = 0; i < dirs_len; ++i) {
+      if ((uint64_t) ds[i].path + ds[i].path_len >= h->strings_size) return false;
+    }
+
+    const auto *es = (const system_index_entry_t *) ((const char *) h + entries_at);
+    for (size_t i = 0; i < h->entries_len; ++i) {
+      for (const auto &[off, len]: {
+        std::pair{es[i].id, es[i].id_len},
+        std::pair{es[i].name, es[i].name_len},
+        std::pair{es[i].exec, es[i].exec_len},
+        std::pair{es[i].initials, es[i].initials_len},
+      }) {
+        if ((uint64_t) off + len >= h->strings_size) return false;
+      }
+    }
+
+    const auto *ss = (const char *) h + strings_at;
+    return covered(h, ds, ss, user_dirs) && !stale(h, ds, ss);
+  }
+
+  // maps path read-only for the rest of the process, false when there is
+  // no usable index for the user's dirs
+  bool map(const char *path, const std::vector<std::string> &user_dirs)
+  {
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof(system_index_header_t)) {
+      close(fd);
+      return false;
+    }
+
+    const size_t size = st.st_size;
+    void *ptr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED) return false;
+
+    const auto *h = (const system_index_header_t *) ptr;
+    if (!valid(h, size, user_dirs)) {
+      munmap(ptr, size);
+      return false;
+    }
+
+    header = h;
+    dirs = (const system_index_dir_t *) (h + 1);
+    entries = (const system_index_entry_t *) (dirs + h->dirs_len + h->walked_len);
+    strings = (const char *) (entries + h->entries_len);
+    return true;
+  }
+};
+
+static system_index_t system_index;
+
+struct system_index_writer_t {
+  uint64_t built = realtime_ns();
+  std::vector<system_index_dir_t> dirs;
+  size_t dirs_len = 0;
+  std::vector<system_index_entry_t> entries;
+  std::string strings;
+
+  uint32_t add_string(const std::string_view &s)
+  {
+    const uint32_t ret = strings.size();
+    strings += s;
+    strings += '\0';
+    return ret;
+  }
+
+  void add(const std::string_view &id,
+           const std::string_view &name,
+           const std::string_view &exec,
+           const std::string_view &initials)
+  {
+    entries.push_back({
+      .id = add_string(id),
+      .id_len = (uint32_t) id.size(),
+      .name = add_string(name),
+      .name_len = (uint32_t) name.size(),
+      .exec = add_string(exec),
+      .exec_len = (uint32_t) exec.size(),
+      .initials = add_string(initials),
+      .initials_len = (uint32_t) initials.size(),
+    });
+  }
+
+  // the applications dirs the entries came from, in precedence order, and
+  // every dir discovery walked below them
+  void add_dirs(const std::vector<std::string> &applications_dirs, const std::vector<std::string> &walked)
+  {
+    for (const auto *list: {&applications_dirs, &walked}) {
+      for (const auto &dir: *list) {
+        dirs.push_back({.path = add_string(dir), .path_len = (uint32_t) dir.size()});
+      }
+    }
+    dirs_len = applications_dirs.size();
+  }
+
+  // written next to path and renamed over it, so a rapp starting meanwhile
+  // maps either the old or the new index
+  bool write(const char *path) const
+  {
+    const std::string_view path_sv = path;
+    const auto slash = path_sv.rfind('/');
+    if (slash != std::string_view::npos && slash > 0) {
+      mkdir(std::string(path_sv.substr(0, slash)).c_str(), 0755);
+    }
+
+    const auto tmp = std::string(path) + ".tmp." + std::to_string(getpid());
+    const int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+      fprintf(stderr, "could not create %s: %s\n", tmp.c_str(), strerror(errno));
+      return false;
+    }
+
+    const system_index_header_t header = {
+      .magic = SYSTEM_INDEX_MAGIC,
+      .version = SYSTEM_INDEX_VERSION,
+      .built = built,
+      .dirs_len = (uint32_t) dirs_len,
+      .walked_len = (uint32_t) (dirs.size() - dirs_len),
+      .entries_len = (uint32_t) entries.size(),
+      .strings_size = (uint32_t) strings.size(),
+    };
+
+    const auto dirs_size = dirs.size() * sizeof(system_index_dir_t);
+    const auto entries_size = entries.size() * sizeof(system_index_entry_t);
+    const auto ok = ::write(fd, &header, sizeof(header)) == sizeof(header)
+      && ::write(fd, dirs.data(), dirs_size) == (ssize_t) dirs_size
+      && ::write(fd, entries.data(), entries_size) == (ssize_t) entries_size
+      && ::write(fd, strings.data(), strings.size()) == (ssize_t) strings.size()
+      && fsync(fd) == 0;
+
+    close(fd);
+
+    if (!ok || rename(tmp.c_str(), path) == -1) {
+      fprintf(stderr, "could not write %s: %s\n", path, strerror(errno));
+      unlink(tmp.c_str());
+      return false;
+    }
+
+    return true;
+  }
+};
@@ -0,0 +1,169 @@
+#pragma once
+
+// scoped tracing, compiled out unless built with -DRAPP_TRACE.
+// events go into a preallocated ring buffer and are dumped as chrome
+// trace-event json (chrome://tracing, ui.perfetto.dev) to $RAPP_TRACE on exit.
+// every scope also carries the allocations made on its thread while it was
+// open (see the operator new hook in metrics.h), totals per phase are
+// printed to stderr on exit.
+
+#if defined(RAPP_TRACE)
+
+#include <time.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include <atomic>
+
+namespace trace {
+
+struct event_t {
+  const char *name;
+  uint64_t ts, dur;
+  uint64_t allocs, bytes;
+  uint32_t tid;
+};
+
+constexpr size_t EVENTS_CAP = 1 << 16;
+
+static event_t events[EVENTS_CAP];
+static std::atomic<size_t> events_len;
+
+static thread_local uint64_t allocs, alloc_bytes;
+
+static inline void count_alloc(size_t n) noexcept
+{
+  allocs++;
+  alloc_bytes += n;
+}
+
+static inline uint64_t now(void) noexcept
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline uint32_t tid(void) noexcept
+{
+  static thread_local uint32_t tid = syscall(SYS_gettid);
+  return tid;
+}
+
+static inline void emit(const char *name,
+                        uint64_t ts,
+                        uint64_t dur,
+                        uint64_t allocs,
+                        uint64_t bytes) noexcept
+{
+  const auto i = events_len.fetch_add(1, std::memory_order_relaxed);
+  events[i & (EVENTS_CAP - 1)] = {name, ts, dur, allocs, bytes, tid()};
+}
+
+struct scope_t {
+  const char *name;
+  uint64_t start, start_allocs, start_bytes;
+
+  inline scope_t(const char *name) noexcept
+    : name(name), start(now()), start_allocs(allocs), start_bytes(alloc_bytes) {}
+
+  inline ~scope_t(void) noexcept
+  {
+    emit(name, start, now() - start, allocs - start_allocs, alloc_bytes - start_bytes);
+  }
+};
+
+static inline void report_phases(size_t start, size_t len)
+{
+  struct phase_t {
+    const char *name;
+    uint64_t calls, dur, allocs, bytes;
+  };
+
+  constexpr size_t PHASES_CAP = 64;
+  static phase_t phases[PHASES_CAP];
+  size_t phases_len = 0;
+
+  for (size_t i = start; i < len; ++i) {
+    const auto &e = events[i & (EVENTS_CAP - 1)];
+
+    size_t j = 0;
+    while (j < phases_len && strcmp(phases[j].name, e.name) != 0) j++;
+    if (j == phases_len) {
+      if (phases_len == PHASES_CAP) continue;
+      phases[phases_len++] = {e.name, 0, 0, 0, 0};
+    }
+
+    phases[j].calls++;
+    phases[j].dur += e.dur;
+    phases[j].allocs += e.allocs;
+    phases[j].bytes += e.bytes;
+  }
+
+  fprintf(stderr, "%-24s %8s %12s %10s %12s\n", "phase", "calls", "total ms", "allocs", "bytes");
+  for (size_t j = 0; j < phases_len; ++j) {
+    const auto &p = phases[j];
+    fprintf(stderr,
+            "%-24s %8lu %12.3f %10lu %12lu\n",
+            p.name,
+            p.calls,
+            p.dur / 1e6,
+            p.allocs,
+            p.bytes);
+  }
+}
+
+static inline void dump(void)
+{
+  const char *path = getenv("RAPP_TRACE");
+  if (!path) return;
+
+  FILE *f = fopen(path, "w");
+  if (!f) {
+    fprintf(stderr, "could not open trace file: %s\n", path);
+    return;
+  }
+
+  const auto len = events_len.load(std::memory_order_relaxed);
+  const auto start = len > EVENTS_CAP ? len - EVENTS_CAP : 0;
+  const auto pid = getpid();
+
+  fprintf(f, "{\"traceEvents\":[\n");
+  for (size_t i = start; i < len; ++i) {
+    const auto &e = events[i & (EVENTS_CAP - 1)];
+    fprintf(f,
+            "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%u,"
+            "\"args\":{\"allocs\":%lu,\"bytes\":%lu}}\n",
+            i == start ? "" : ",",
+            e.name,
+            e.ts / 1000.0,
+            e.dur / 1000.0,
+            pid,
+            e.tid,
+            e.allocs,
+            e.bytes);
+  }
+  fprintf(f, "],\"displayTimeUnit\":\"ns\"}\n");
+
+  fclose(f);
+
+  report_phases(start, len);
+}
+
+}
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) const trace::scope_t TRACE_CONCAT(trace_scope_, __LINE__){name}
+#define TRACE_DUMP() trace::dump()
+
+#else
+
+#define TRACE_SCOPE(name) (void) 0
+#define TRACE_DUMP() (void) 0
+
+#endif